@@ -0,0 +1,102 @@
+#ifndef CHIP8_SHM_H
+#define CHIP8_SHM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+Layout of the shared memory segment the emulator publishes into when it's started with a shm name.
+The emulator is the only writer. Readers map it read only and use readSharedState to get a consistent copy.
+
+It's a seqlock: the writer bumps sequence to odd, writes the state, then bumps it back to even. A reader copies the
+state and if sequence was odd or changed while it was copying it just tries again. The writer never waits on readers
+and never makes a syscall to publish so it doesn't matter how many readers there are.
+*/
+
+#define CHIP8_SHM_MAGIC 0x38504843u
+#define CHIP8_SHM_VERSION 2u
+
+typedef struct Chip8State {
+    uint8_t registers[16];
+    uint16_t pc;
+    uint16_t idx;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    //Counts published frames so readers can tell if anything new showed up since their last read
+    uint64_t frame;
+    //One uint64_t per row with the leftmost pixel in the top bit, use sharedPixel to read it
+    uint64_t display[32];
+} Chip8State;
+
+typedef struct Chip8Shared {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t sequence;
+    Chip8State state;
+} Chip8Shared;
+
+//Maps an existing segment read only. Returns NULL if it doesn't exist or isn't ours
+static inline Chip8Shared const* openSharedState(char const* name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    void* mapped = mmap(NULL, sizeof(Chip8Shared), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        return NULL;
+    }
+
+    Chip8Shared const* shared = (Chip8Shared const*)mapped;
+
+    if (shared->magic != CHIP8_SHM_MAGIC || shared->version != CHIP8_SHM_VERSION) {
+        munmap(mapped, sizeof(Chip8Shared));
+        return NULL;
+    }
+
+    return shared;
+}
+
+static inline void closeSharedState(Chip8Shared const* shared) {
+    munmap((void*)shared, sizeof(Chip8Shared));
+}
+
+//Copies a consistent snapshot into out. Spins while the writer is halfway through a publish
+static inline void readSharedState(Chip8Shared const* shared, Chip8State* out) {
+    Chip8Shared* writable = (Chip8Shared*)shared;
+
+    while (true) {
+        uint32_t before = atomic_load_explicit(&writable->sequence, memory_order_acquire);
+
+        if (before & 1u) {
+            continue;
+        }
+
+        memcpy(out, &shared->state, sizeof(Chip8State));
+
+        atomic_thread_fence(memory_order_acquire);
+
+        if (atomic_load_explicit(&writable->sequence, memory_order_relaxed) == before) {
+            return;
+        }
+    }
+}
+
+static inline bool sharedPixel(Chip8State const* state, int x, int y) {
+    return (state->display[y & 31] >> (63 - (x & 63))) & 1u;
+}
+
+//Cheap check for whether there's anything new without copying the whole state
+static inline uint32_t sharedStateSequence(Chip8Shared const* shared) {
+    return atomic_load_explicit(&((Chip8Shared*)shared)->sequence, memory_order_acquire);
+}
+
+#endif
@@ -5,6 +5,19 @@
 #include <SDL2/SDL_render.h>
 #include <time.h>
 #include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
+#include "chip8_shm.h"
 
 //Starting addresses
 const unsigned int startingAddress = 0x200;
@@ -13,8 +26,24 @@ const unsigned int fontSetStartAddress = 0x50;
 int SCREEN_HEIGHT = 32;
 int SCREEN_WIDTH = 64;
 
+#define MEMORY_SIZE 4096
+#define PAGE_SIZE 256
+#define PAGE_COUNT (MEMORY_SIZE / PAGE_SIZE)
+#define PAGE_PERMANENT 0xFFFFFFFFu
+
+/*
+Memory is 16 pages of 256 bytes and a page can be shared by any number of machines and snapshots. refCount counts
+everyone pointing at it and a write to a page anyone else can see makes a private copy first (copy on write). So
+machines running the same ROM all share the font and ROM pages until they write over them, and a snapshot is just
+16 pointers instead of 4KB.
+*/
+typedef struct MemoryPage {
+    uint32_t refCount;
+    uint8_t bytes[PAGE_SIZE];
+} MemoryPage;
+
 uint8_t registers[16];
-uint8_t memory[4096];
+MemoryPage* memoryPages[PAGE_COUNT];
 uint16_t idx;
 uint16_t pc = 0;
 uint16_t stack[16];
@@ -22,9 +51,129 @@ uint8_t stackPointer;
 uint8_t delayTimer;
 uint8_t soundTimer;
 uint8_t keys[16];
-uint32_t display[64 * 32];
+//One uint64_t per row with the leftmost pixel in the top bit
+uint64_t display[32];
 uint16_t opcode;
 
+//Addresses wrap at 4KB so nothing can read outside the machine
+static inline uint8_t readMemory(uint16_t address) {
+    return memoryPages[(address >> 8) & 0xFu]->bytes[address & 0xFFu];
+}
+
+/*
+While trackStateHash is set, memoryHash and displayHash are kept up to date on every write instead of rehashing 4KB.
+Each byte (or screen row) contributes a mixed value of where it is and what's in it and they're all XORed together,
+so a write just XORs the old contribution out and the new one in.
+*/
+bool trackStateHash = false;
+uint64_t memoryHash;
+uint64_t displayHash;
+
+//splitmix64 finalizer
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+
+    return x;
+}
+
+static inline uint64_t memoryCellHash(uint16_t address, uint8_t value) {
+    return mix64(((uint64_t)address << 8) | value);
+}
+
+static inline uint64_t displayRowHash(int row, uint64_t bits) {
+    return mix64(bits ^ mix64(0x10000u + row));
+}
+
+//CXKK uses this instead of rand() so the random numbers are part of the machine state and can be saved and replayed
+uint32_t rngState = 0x9E3779B9u;
+
+//Set by anything that draws so publishState knows if it has to copy the screen again
+bool displayDirty = true;
+
+/*
+Things a ROM can do that a real machine would choke on. The opcodes refuse to do the bad access and record the first
+fault here so whoever is running the machine can stop it (the fuzzer looks for these).
+*/
+typedef enum MachineFault {
+    FAULT_NONE,
+    FAULT_STACK_OVERFLOW,
+    FAULT_STACK_UNDERFLOW,
+    FAULT_MEMORY_BOUNDS,
+    FAULT_PC_BOUNDS
+} MachineFault;
+
+MachineFault machineFault = FAULT_NONE;
+uint16_t faultAddress;
+
+//Set while the fuzzer wants coverage, see the Fuzzer section
+bool coverageEnabled = false;
+
+//Set while gdb is connected, see the GDB remote stub section
+bool debuggerAttached = false;
+
+//Turned off for headless runs so TableF and OP_DXYN dont flood stdout
+bool traceOpcodes = true;
+
+//One key change from an input log. cycle is the instruction count it happens at, key is 0-F and pressed is 1 for down 0 for up
+typedef struct InputEvent {
+    uint64_t cycle;
+    uint8_t key;
+    uint8_t pressed;
+} InputEvent;
+
+//Why a headless run stopped
+typedef enum ExitReason {
+    EXIT_BUDGET,
+    //Sitting on a 1NNN that jumps to itself
+    EXIT_HALT,
+    //Going round a loop that doesn't change anything
+    EXIT_LIVELOCK,
+    //FX0A waiting for a key and the input log has nothing left
+    EXIT_INPUT_WAIT,
+    EXIT_FAULT
+} ExitReason;
+
+typedef struct RunResult {
+    //Where the machine ended up, cycles skipped over by going around a detected loop count too
+    uint64_t cycles;
+    //Instructions that actually ran
+    uint64_t executed;
+    ExitReason reason;
+} RunResult;
+
+//How often runHeadless looks at the state hash for loops. Starts often so short loops get caught fast and backs off
+//while nothing turns up so ROMs that never loop don't keep paying for it
+#define HALT_CHECK_INTERVAL 16
+#define HALT_CHECK_MAX_INTERVAL 256
+
+#define MAX_INPUT_EVENTS 4096
+
+//How many instructions make up one frame when something needs to step the machine a frame at a time (netplay)
+#define CYCLES_PER_FRAME 10
+
+/*
+Everything that makes up the machine so it can be saved and put back exactly. Memory is held as page references so the
+whole thing is 448 bytes: the first cache line has everything an instruction touches besides memory and the screen,
+then two lines of page pointers and four of screen. Lots of these side by side is how a fleet of machines is stored.
+*/
+typedef struct MachineState {
+    _Alignas(64) uint8_t registers[16];
+    uint16_t stack[16];
+    uint16_t idx;
+    uint16_t pc;
+    uint16_t keys;
+    uint8_t stackPointer;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    uint32_t rngState;
+    MemoryPage* pages[PAGE_COUNT];
+    uint64_t display[32];
+} MachineState;
+
 typedef struct SDL_VARS {
     SDL_Window* window;
     SDL_Renderer* renderer;
@@ -33,6 +182,9 @@ typedef struct SDL_VARS {
 
 SDL_VARS sdlVars;
 
+//Only mapped when a shm name is given on the command line
+Chip8Shared* sharedState = NULL;
+
 const unsigned int fontSetSize = 80;
 uint8_t fontSet[80] = {
 	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -54,20 +206,57 @@ uint8_t fontSet[80] = {
 };
 
 void initSDL(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight);
-void loadROM(char const* fileName);
-bool proccessInput();
+bool loadROM(char const* fileName);
+bool proccessInput(uint8_t* keypad);
 void fdeLoop();
 void updateDisplay(void const* buffer, int pitch);
 void initTables();
-
-//For the tables the way it works is for example table 0 you need to reserve 0xE + 1 so that the last memory indice EE is valid
+void initMachine();
+int loadInputLog(char const* fileName, InputEvent* events, int maxEvents);
+RunResult runHeadless(uint64_t cycleBudget, InputEvent const* events, int eventCount);
+char const* exitReasonName(ExitReason reason);
+void resetStateHash();
+void resetDisplayHash();
+uint64_t stateHash();
+uint64_t hashDisplay();
+void seedRandom(uint32_t seed);
+void writeMemory(uint16_t address, uint8_t value);
+void raiseFault(MachineFault fault, uint16_t address);
+char const* faultName(MachineFault fault);
+void recordCoverage();
+void runFuzzer(char const* romName, char const* corpusDir, uint64_t runs, int frames);
+void runCorpus(char const* corpusPath, char const* reportPath, int workers, uint64_t defaultCycles);
+void retainPage(MemoryPage* page);
+void releasePage(MemoryPage* page);
+void saveState(MachineState* state);
+void loadState(MachineState const* state);
+void takeState(MachineState* state);
+uint64_t hashState(MachineState const* state);
+void setKeypad(uint16_t mask);
+uint16_t keypadMask(uint8_t const* keypad);
+void runFrame();
+void runNetplay(int videoScale, char const* romName, int localPort, char const* remoteHost, int remotePort, uint32_t seed);
+void runNetplayTest(char const* romName, uint32_t frames, int latencyFrames, int lossPercent);
+void runRunAhead(int videoScale, char const* romName, int aheadFrames, char const* shmName);
+void runFleet(uint32_t count, uint64_t cycles, char const* romName);
+void runServer(char const* socketPath);
+void serveRun(int client);
+bool createSharedState(char const* name);
+void startDebugger(char const* address);
+void pollDebugger();
+bool debugBeforeInstruction();
+void debugAfterInstruction();
+void debugCheckWatch(uint16_t address, int length, bool write);
+void publishState();
+
+//For the tables the way it works is every table needs a slot for every value its index can have, so table 0 needs 0xF + 1 even though EE is the last real one. Otherwise a ROM with 800F or F0FF in it calls whatever is past the end of the table
 
 //You write it like void (table[])(void) to specify that the type of the pointer is void and that its a array of pointers to functions and then you put (void) to specify that theres no params
 void (*table[0xF + 1])(void);
-void (*table0[0xE + 1])(void);
-void (*table8[0xE + 1])(void);
-void (*tableE[0xE + 1])(void);
-void (*tableF[0x65 + 1])(void);
+void (*table0[0xF + 1])(void);
+void (*table8[0xF + 1])(void);
+void (*tableE[0xF + 1])(void);
+void (*tableF[0xFF + 1])(void);
 
 //Pointer functions (i hope thats what theyre actually called)
 void Table0() {
@@ -83,7 +272,10 @@ void TableE() {
 }
 
 void TableF() {
-    printf("PC: 0x%03X | Opcode: 0x%04X\n", pc, opcode);
+    if (traceOpcodes) {
+        printf("PC: 0x%03X | Opcode: 0x%04X\n", pc, opcode);
+    }
+
     tableF[opcode & 0x00FF]();
 }
 
@@ -128,39 +320,110 @@ void TableE();
 void TableF();
 
 int main(int argc, char** argv) {
-    if (argc != 4) {
-        printf("Usage %s <Scale> <Delay> <Rom>\n", argv[0]);
+    if (argc == 3 && strcmp(argv[1], "--server") == 0) {
+        runServer(argv[2]);
+        return 0;
+    }
+
+    if ((argc == 7 || argc == 8) && strcmp(argv[1], "--netplay") == 0) {
+        uint32_t seed = (argc == 8) ? strtoul(argv[7], NULL, 10) : 0;
+        runNetplay(atoi(argv[2]), argv[3], atoi(argv[4]), argv[5], atoi(argv[6]), seed);
+        return 0;
+    }
+
+    if ((argc == 5 || argc == 6) && strcmp(argv[1], "--runahead") == 0) {
+        runRunAhead(atoi(argv[2]), argv[3], atoi(argv[4]), (argc == 6) ? argv[5] : NULL);
+        return 0;
+    }
+
+    if (argc == 5 && strcmp(argv[1], "--fleet") == 0) {
+        runFleet(strtoul(argv[2], NULL, 10), strtoull(argv[3], NULL, 10), argv[4]);
+        return 0;
+    }
+
+    if ((argc == 5 || argc == 6) && strcmp(argv[1], "--fuzz") == 0) {
+        int frames = (argc == 6) ? atoi(argv[5]) : 64;
+        runFuzzer(argv[2], argv[3], strtoull(argv[4], NULL, 10), frames);
+        return 0;
+    }
+
+    if (argc >= 4 && argc <= 6 && strcmp(argv[1], "--corpus") == 0) {
+        int workers = (argc >= 5) ? atoi(argv[4]) : 0;
+        uint64_t defaultCycles = (argc == 6) ? strtoull(argv[5], NULL, 10) : 1000000;
+        runCorpus(argv[2], argv[3], workers, defaultCycles);
+        return 0;
+    }
+
+    if ((argc == 5 || argc == 6) && strcmp(argv[1], "--netplay-test") == 0) {
+        int lossPercent = (argc == 6) ? atoi(argv[5]) : 0;
+        runNetplayTest(argv[2], strtoul(argv[3], NULL, 10), atoi(argv[4]), lossPercent);
+        return 0;
+    }
+
+    char const* debugAddress = NULL;
+
+    //--gdb just goes in front of the normal arguments. Shift past it but keep the program name for the usage message
+    if (argc >= 3 && strcmp(argv[1], "--gdb") == 0) {
+        debugAddress = argv[2];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc != 4 && argc != 5) {
+        printf("Usage %s <Scale> <Delay> <Rom> [ShmName]\n", argv[0]);
+        printf("      %s --gdb <Port|SocketPath> <Scale> <Delay> <Rom> [ShmName]\n", argv[0]);
+        printf("      %s --server <SocketPath>\n", argv[0]);
+        printf("      %s --netplay <Scale> <Rom> <LocalPort> <RemoteHost> <RemotePort> [Seed]\n", argv[0]);
+        printf("      %s --runahead <Scale> <Rom> <Frames> [ShmName]\n", argv[0]);
+        printf("      %s --netplay-test <Rom> <Frames> <LatencyFrames> [LossPercent]\n", argv[0]);
+        printf("      %s --fleet <Machines> <Cycles> <Rom>\n", argv[0]);
+        printf("      %s --fuzz <Rom> <CorpusDir> <Runs> [Frames]\n", argv[0]);
+        printf("      %s --corpus <Manifest|RomDir> <Report.jsonl> [Workers] [DefaultCycles]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    srand(time(NULL));
+    seedRandom(time(NULL));
 
     int videoScale = atoi(argv[1]);
     int delay = atoi(argv[2]);
     char const* romName = argv[3];
+    char const* shmName = (argc == 5) ? argv[4] : NULL;
+
+    if (shmName != NULL && !createSharedState(shmName)) {
+        printf("Couldn't create shared memory %s\n", shmName);
+        exit(EXIT_FAILURE);
+    }
 
     initSDL("CHIP8 Emulator", SCREEN_WIDTH * videoScale, SCREEN_HEIGHT * videoScale, SCREEN_WIDTH, SCREEN_HEIGHT);
     printf("SDL init finished \n");
 
     initTables();
-
-    pc = startingAddress;
-
-    for (int i = 0; i < fontSetSize; ++i) {
-        memory[fontSetStartAddress + i] = fontSet[i];
-    }
+    initMachine();
 
     printf("loading ROM \n");
-    loadROM(romName);
+    if (!loadROM(romName)) {
+        printf("Couldn't load ROM %s\n", romName);
+        exit(EXIT_FAILURE);
+    }
     printf("ROM done loading \n");
 
-    int pitch = sizeof(display[0]) * SCREEN_WIDTH;
+    if (debugAddress != NULL) {
+        traceOpcodes = false;
+        startDebugger(debugAddress);
+    }
+
+    int pitch = sizeof(uint32_t) * SCREEN_WIDTH;
 
     uint32_t lastCycleTime = SDL_GetTicks();
     bool shouldStop = false;
 
     while (!shouldStop) {
-        shouldStop = proccessInput();
+        shouldStop = proccessInput(keys);
+
+        if (debuggerAttached) {
+            pollDebugger();
+        }
 
         uint32_t currentTime = SDL_GetTicks();
         uint32_t dt = currentTime - lastCycleTime;
@@ -171,9 +434,14 @@ int main(int argc, char** argv) {
             fdeLoop();
 
             updateDisplay(display, pitch);
+            publishState();
         }
     }
 
+    if (shmName != NULL) {
+        shm_unlink(shmName);
+    }
+
     return 0;
 }
 
@@ -195,13 +463,13 @@ void initTables() {
     table[0xE] = TableE;
     table[0xF] = TableF;
 
-    for (int i = 0; i <= 0xE; ++i) {
+    for (int i = 0; i <= 0xF; ++i) {
         table0[i] = OP_NULL;
         table8[i] = OP_NULL;
         tableE[i] = OP_NULL;
     }
 
-    for (int i = 0; i <= 0x65; ++i) {
+    for (int i = 0; i <= 0xFF; ++i) {
         tableF[i] = OP_NULL;
     }
 
@@ -232,29 +500,144 @@ void initTables() {
     tableF[0x1E] = OP_FX1E;
 }
 
-void loadROM(char const* fileName) {
+//Every page starts out as this one. It's never freed or written to, writes always get their own copy
+MemoryPage zeroPage = { PAGE_PERMANENT };
+
+//Puts the pc at the start of the program and copies the font into memory. Safe to call again to start over
+void initMachine() {
+    memset(registers, 0, sizeof(registers));
+    memset(stack, 0, sizeof(stack));
+    memset(keys, 0, sizeof(keys));
+    memset(display, 0, sizeof(display));
+    idx = 0;
+    stackPointer = 0;
+    delayTimer = 0;
+    soundTimer = 0;
+    machineFault = FAULT_NONE;
+    displayDirty = true;
+
+    pc = startingAddress;
+
+    for (int i = 0; i < PAGE_COUNT; ++i) {
+        releasePage(memoryPages[i]);
+        memoryPages[i] = &zeroPage;
+    }
+
+    for (int i = 0; i < fontSetSize; ++i) {
+        writeMemory(fontSetStartAddress + i, fontSet[i]);
+    }
+}
+
+//Only the first fault sticks, whatever comes after it is usually fallout from the first one
+void raiseFault(MachineFault fault, uint16_t address) {
+    if (machineFault == FAULT_NONE) {
+        machineFault = fault;
+        faultAddress = address;
+    }
+}
+
+char const* faultName(MachineFault fault) {
+    switch (fault) {
+        case FAULT_NONE:
+            return "none";
+        case FAULT_STACK_OVERFLOW:
+            return "stack-overflow";
+        case FAULT_STACK_UNDERFLOW:
+            return "stack-underflow";
+        case FAULT_MEMORY_BOUNDS:
+            return "memory-bounds";
+        case FAULT_PC_BOUNDS:
+            return "pc-bounds";
+    }
+
+    return "unknown";
+}
+
+//Memory pages
+
+void retainPage(MemoryPage* page) {
+    if (page != NULL && page->refCount != PAGE_PERMANENT) {
+        ++page->refCount;
+    }
+}
+
+void releasePage(MemoryPage* page) {
+    if (page != NULL && page->refCount != PAGE_PERMANENT && --page->refCount == 0) {
+        free(page);
+    }
+}
+
+//First write to a page someone else can see swaps in a private copy of it
+void writeMemory(uint16_t address, uint8_t value) {
+    MemoryPage** page = &memoryPages[(address >> 8) & 0xFu];
+
+    if (trackStateHash) {
+        memoryHash ^= memoryCellHash(address & 0xFFFu, readMemory(address)) ^ memoryCellHash(address & 0xFFFu, value);
+    }
+
+    if ((*page)->refCount != 1) {
+        MemoryPage* copy = (MemoryPage*)malloc(sizeof(MemoryPage));
+        memcpy(copy->bytes, (*page)->bytes, PAGE_SIZE);
+        copy->refCount = 1;
+        releasePage(*page);
+        *page = copy;
+    }
+
+    (*page)->bytes[address & 0xFFu] = value;
+}
+
+bool loadROM(char const* fileName) {
     FILE* romFile = fopen(fileName, "rb");
     
-    if (romFile != NULL) {
-        //Get file size then rewind to the start of the file stream
-        fseek(romFile, 0, SEEK_END);
-        long size = ftell(romFile);
-        rewind(romFile);
-
-        char* buffer = (char*)malloc(size);
-        fread(buffer, size, 1, romFile);
+    if (romFile == NULL) {
+        return false;
+    }
+
+    //Get file size then rewind to the start of the file stream
+    long size = (fseek(romFile, 0, SEEK_END) == 0) ? ftell(romFile) : -1;
+    rewind(romFile);
+
+    //Directories and things like /proc files that don't know their size end up here too, not just empty files
+    if (size <= 0) {
         fclose(romFile);
+        return false;
+    }
 
-        for (long i = 0; i < size; ++i) {
-            memory[startingAddress + i] = buffer[i];
-        }
+    //Anything past the end of memory gets cut off
+    if (size > MEMORY_SIZE - startingAddress) {
+        size = MEMORY_SIZE - startingAddress;
+    }
+
+    char* buffer = (char*)malloc(size);
+    size_t got = fread(buffer, 1, size, romFile);
+    fclose(romFile);
 
+    if (got != (size_t)size) {
         free(buffer);
+        return false;
+    }
+
+    for (long i = 0; i < size; ++i) {
+        writeMemory(startingAddress + i, buffer[i]);
     }
+
+    free(buffer);
+
+    return true;
 }
 
+//xorshift32, the top byte is the most random part of it
 uint8_t randByte() {
-    return rand() % 256;
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+
+    return rngState >> 24;
+}
+
+//xorshift gets stuck on 0 forever so 0 gets swapped for something else
+void seedRandom(uint32_t seed) {
+    rngState = (seed != 0) ? seed : 0x9E3779B9u;
 }
 
 //Instructions
@@ -278,10 +661,20 @@ only operate on the boolean expression level, BUTTTT bitwise operates on the ind
 //00E0/CLS clears the screen memory
 void OP_00E0() {
     memset(display, 0, sizeof(display));
+    displayDirty = true;
+
+    if (trackStateHash) {
+        resetDisplayHash();
+    }
 }
 
 //00EE/RET retrieves the previous instruction off the stack and decrements the stack pointer
 void OP_00EE() {
+    if (stackPointer == 0) {
+        raiseFault(FAULT_STACK_UNDERFLOW, pc - 2);
+        return;
+    }
+
     --stackPointer;
     pc = stack[stackPointer];
 }
@@ -293,6 +686,11 @@ void OP_1NNN() {
 
 //2NNN/CALL adds a instruction to the stack and increments the stack pointer and then sets the program counter to nnn (12bit instruction)
 void OP_2NNN() {
+    if (stackPointer >= 16) {
+        raiseFault(FAULT_STACK_OVERFLOW, pc - 2);
+        return;
+    }
+
     stack[stackPointer] = pc;
     ++stackPointer;
     pc = opcode & 0x0FFFu;
@@ -496,7 +894,7 @@ the cordinates it should wrap around to the opposite side of the screen.
 //N in this case is the height of the screen when you go through the for loop
 
 /*
-Ts function also gets a more in depth explanation because it happens to be the most confusing thing (so far). So obv you grab x, y, and n then you get the modulus of the values at Vx and Vy so that if its greater than the width or height it wraps around to the other side of the screen. then you start a for loop that goes through the rows of the screen that you need to draw the sprite onto the screen, but if your anything like me you may ask "hmmmm why do we have the index then" well we have it so that you start where your supposed to. Now lets move onto the column loop because thats also super complicated. so a sprite is 8xN n being the number given in the instruction its max is 15. you shift the sprite byte right by 1 every time to check the individual bits to see if the pixel is on or not. Then you get the position of the pixel on the screen you get the address and not the value since you want to actually be able to modify the value in memory and not a copy of the value. the if statement for spritepixel is used to check if the spritepixel is on. Then you check if the pixel is coliding or not if so check the overflow flag (Vf) this is used for collision detection. then you XOR the value in memory to flip the bits on and off.
+Ts function also gets a more in depth explanation because it happens to be the most confusing thing (so far). So obv you grab x, y, and n then you get the modulus of the values at Vx and Vy so that if its greater than the width or height it wraps around to the other side of the screen. then you start a for loop that goes through the rows of the screen that you need to draw the sprite onto the screen, but if your anything like me you may ask "hmmmm why do we have the index then" well we have it so that you start where your supposed to. Now for the row itself. a sprite is 8xN n being the number given in the instruction its max is 15. every screen row is one uint64_t where the top bit is the leftmost pixel so you slide the sprite byte all the way to the top and then right by xpos to line it up with where it goes (anything hanging off the right edge just falls off the end). if the sprite row and the screen row have any bit on in the same place thats a collision so set the overflow flag (Vf) which is used for collision detection. then you XOR the sprite row into the screen row to flip all 8 pixels on and off at once.
 */
 
 /*
@@ -512,29 +910,37 @@ void OP_DXYN() {
     int ypos = registers[y] % SCREEN_HEIGHT;
 
     registers[0xF] = 0;
+    displayDirty = true;
 
-    for (int row = 0; row < n; ++row) {
-        //Get sprite byte starting at i
-        int spriteByte = memory[idx + row];
+    if (idx + n > MEMORY_SIZE) {
+        raiseFault(FAULT_MEMORY_BOUNDS, pc - 2);
+        return;
+    }
 
-        printf("spriteByte is: %s\n", (spriteByte == 0) ? "zero" : "non-zero");
+    if (debuggerAttached) {
+        debugCheckWatch(idx, n, false);
+    }
 
-        for (int col = 0; col < 8; ++col) {
-            //Check the individual pixel 0x80 == 10000000 so shift right by num of colums to get a pixel
-            int spritePixel = spriteByte & (0x80u >> col);
+    //Rows past the bottom get cut off
+    for (int row = 0; row < n && ypos + row < SCREEN_HEIGHT; ++row) {
+        //Get sprite byte starting at i
+        int spriteByte = readMemory(idx + row);
 
-            //Calc screen pos
-            uint32_t* screenPixel = &display[(ypos + row) * SCREEN_WIDTH + (xpos + col)];
+        if (traceOpcodes) {
+            printf("spriteByte is: %s\n", (spriteByte == 0) ? "zero" : "non-zero");
+        }
 
-            /*check if sprite pixel is on if it is then check for collision with the pixel on screen currently if there is set the collision flag then XOR the screenpixel to flip the pixel bit on and off*/
-            if (spritePixel) {
-                if (*screenPixel == 0xFFFFFFFF) {
-                    registers[0xF] = 1;
-                }
+        uint64_t spriteRow = ((uint64_t)spriteByte << 56) >> xpos;
 
-                *screenPixel ^= 0xFFFFFFFF;
-            }
+        if (display[ypos + row] & spriteRow) {
+            registers[0xF] = 1;
+        }
+
+        if (trackStateHash) {
+            displayHash ^= displayRowHash(ypos + row, display[ypos + row]) ^ displayRowHash(ypos + row, display[ypos + row] ^ spriteRow);
         }
+
+        display[ypos + row] ^= spriteRow;
     }
 }
 
@@ -542,7 +948,8 @@ void OP_DXYN() {
 void OP_EX9E() {
     int x = (opcode & 0x0F00u) >> 8u;
 
-    int key = registers[x];
+    //Only 16 keys, anything bigger just uses the low nibble
+    int key = registers[x] & 0xFu;
 
     if (keys[key]) {
         pc += 2;
@@ -553,7 +960,8 @@ void OP_EX9E() {
 void OP_EXA1() {
     int x = (opcode & 0x0F00u) >> 8u;
 
-    int key = registers[x];
+    //Only 16 keys, anything bigger just uses the low nibble
+    int key = registers[x] & 0xFu;
 
     if (!keys[key]) {
         pc += 2;
@@ -648,21 +1056,39 @@ void OP_FX33() {
     int x = (opcode & 0x0F00u) >> 8u;
     int value = registers[x];
 
-    memory[idx + 2] = value % 10;
+    if (idx + 3 > MEMORY_SIZE) {
+        raiseFault(FAULT_MEMORY_BOUNDS, pc - 2);
+        return;
+    }
+
+    if (debuggerAttached) {
+        debugCheckWatch(idx, 3, true);
+    }
+
+    writeMemory(idx + 2, value % 10);
     value /= 10;
 
-    memory[idx + 1] = value % 10;
+    writeMemory(idx + 1, value % 10);
     value /= 10;
 
-    memory[idx] = value % 10;
+    writeMemory(idx, value % 10);
 }
 
 //FX55/LD stores registers V0 through Vx in memory starting at location I
 void OP_FX55() {
     int x = (opcode & 0x0F00u) >> 8u;
 
+    if (idx + x + 1 > MEMORY_SIZE) {
+        raiseFault(FAULT_MEMORY_BOUNDS, pc - 2);
+        return;
+    }
+
+    if (debuggerAttached) {
+        debugCheckWatch(idx, x + 1, true);
+    }
+
     for (int i = 0; i <= x; ++i) {
-        memory[idx + i] = registers[i];
+        writeMemory(idx + i, registers[i]);
     }
 }
 
@@ -670,8 +1096,17 @@ void OP_FX55() {
 void OP_FX65() {
     int x = (opcode & 0x0F00u) >> 8u;
 
+    if (idx + x + 1 > MEMORY_SIZE) {
+        raiseFault(FAULT_MEMORY_BOUNDS, pc - 2);
+        return;
+    }
+
+    if (debuggerAttached) {
+        debugCheckWatch(idx, x + 1, false);
+    }
+
     for (int i = 0; i <= x; ++i) {
-        registers[i] = memory[idx + i];
+        registers[i] = readMemory(idx + i);
     }
 }
 
@@ -679,8 +1114,22 @@ void OP_NULL() {}
 
 //Fetch, decode, encode loop
 void fdeLoop() {
+    if (debuggerAttached && !debugBeforeInstruction()) {
+        return;
+    }
+
+    if (coverageEnabled) {
+        recordCoverage();
+    }
+
+    //The second byte of the opcode would be past the end of memory
+    if (pc > MEMORY_SIZE - 2) {
+        raiseFault(FAULT_PC_BOUNDS, pc);
+        return;
+    }
+
     //OR to combine the high byte (gets from shifting 8 bits to the left) and the low byte (get from going into the next byte)
-    opcode = (memory[pc] << 8u) | memory[pc + 1];
+    opcode = (readMemory(pc) << 8u) | readMemory(pc + 1);
     
     //add 2 to the proccess counter to be able to get the next opcode
     pc += 2;
@@ -695,155 +1144,2690 @@ void fdeLoop() {
     if (soundTimer > 0) {
         --soundTimer;
     }
-}
 
-void initSDL(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight) {
-    if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
-        printf("Couldn't init SDL SDL_ERROR: %s", SDL_GetError());
-        return;
+    if (debuggerAttached) {
+        debugAfterInstruction();
     }
+}
 
-    sdlVars.window = SDL_CreateWindow(title, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
+//Headless runs
 
-    if (sdlVars.window == NULL) {
-        printf("Couldn't create window SDL_ERROR: %s", SDL_GetError());
-        return;
+/*
+Input logs are plain text with one key change per line: "<cycle> <key> <pressed>" so "120 A 1" presses key A at cycle 120.
+Key is hex and lines starting with # are skipped. Events have to be in cycle order since runHeadless just walks through them.
+*/
+int loadInputLog(char const* fileName, InputEvent* events, int maxEvents) {
+    FILE* logFile = fopen(fileName, "r");
+
+    if (logFile == NULL) {
+        return -1;
     }
 
-    sdlVars.renderer = SDL_CreateRenderer(sdlVars.window, -1, SDL_RENDERER_ACCELERATED);
+    char line[128];
+    int count = 0;
 
-    sdlVars.texture = SDL_CreateTexture(sdlVars.renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
-}
+    while (count < maxEvents && fgets(line, sizeof(line), logFile) != NULL) {
+        unsigned long long cycle;
+        unsigned int key;
+        unsigned int pressed;
 
-bool proccessInput() {
-    SDL_Event event;
-    bool shouldStop = false;
+        if (line[0] == '#' || sscanf(line, "%llu %x %u", &cycle, &key, &pressed) != 3) {
+            continue;
+        }
 
-    while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-            case SDL_QUIT:
-                shouldStop = true;
-                break;
-            case SDL_KEYDOWN:
-                switch (event.key.keysym.sym) {
-                    case SDLK_1:
-                        keys[1] = 1;
-                        break;
-                    case SDLK_2:
-                        keys[2] = 1;
-                        break;
-                    case SDLK_3:
-                        keys[3] = 1;   
-                        break;
-                    case SDLK_4:
-                        keys[0xC] = 1;
-                        break;
-                    case SDLK_q:
-                        keys[4] = 1;
-                        break;
-                    case SDLK_w:
-                        keys[5] = 1;
-                        break;
-                    case SDLK_e:
-                        keys[6] = 1;
-                        break;
-                    case SDLK_r:
-                        keys[0xD] = 1;
-                        break;
-                    case SDLK_a:
-                        keys[7] = 1;
-                        break;
-                    case SDLK_s:
-                        keys[8] = 1;
-                        break;
-                    case SDLK_d:
-                        keys[9] = 1;
-                        break;
-                    case SDLK_f:
-                        keys[0xE] = 1;
-                        break;
-                    case SDLK_z:
-                        keys[0xA] = 1;
-                        break;
-                    case SDLK_x:
-                        keys[0] = 1;
-                        break;
-                    case SDLK_c:
-                        keys[0xB] = 1;
-                        break;
-                    case SDLK_v:
-                        keys[0xF] = 1;  
-                        break;                                
-                    case SDLK_ESCAPE:
-                        shouldStop = true;
-                        break;
-                    default:
-                        break;    
-            }
-            break;
+        events[count].cycle = cycle;
+        events[count].key = key & 0xFu;
+        events[count].pressed = pressed ? 1 : 0;
+        ++count;
+    }
 
-            case SDL_KEYUP:
-                switch (event.key.keysym.sym) {
-                    case SDLK_1:
-                        keys[1] = 0;
-                        break;
-                    case SDLK_2:
-                        keys[2] = 0;
-                        break;
-                    case SDLK_3:
-                        keys[3] = 0;   
-                        break;
-                    case SDLK_4:
-                        keys[0xC] = 0;
-                        break;
-                    case SDLK_q:
-                        keys[4] = 0;
-                        break;
-                    case SDLK_w:
-                        keys[5] = 0;
-                        break;
-                    case SDLK_e:
-                        keys[6] = 0;
-                        break;
-                    case SDLK_r:
-                        keys[0xD] = 0;
-                        break;
-                    case SDLK_a:
-                        keys[7] = 0;
-                        break;
-                    case SDLK_s:
-                        keys[8] = 0;
-                        break;
-                    case SDLK_d:
-                        keys[9] = 0;
-                        break;
-                    case SDLK_f:
-                        keys[0xE] = 0;
-                        break;
-                    case SDLK_z:
-                        keys[0xA] = 0;
-                        break;
-                    case SDLK_x:
-                        keys[0] = 0;
-                        break;
-                    case SDLK_c:
-                        keys[0xB] = 0;
-                        break;
-                    case SDLK_v:
-                        keys[0xF] = 0;
-                        break;
-                    default:
-                        break;    
-                }
-                break;
-        }
+    fclose(logFile);
+
+    return count;
+}
+
+char const* exitReasonName(ExitReason reason) {
+    switch (reason) {
+        case EXIT_BUDGET:
+            return "budget";
+        case EXIT_HALT:
+            return "halt";
+        case EXIT_LIVELOCK:
+            return "livelock";
+        case EXIT_INPUT_WAIT:
+            return "input-wait";
+        case EXIT_FAULT:
+            return "fault";
     }
 
-    return shouldStop;
+    return "unknown";
 }
 
+void resetDisplayHash() {
+    displayHash = 0;
+
+    for (int row = 0; row < 32; ++row) {
+        displayHash ^= displayRowHash(row, display[row]);
+    }
+}
+
+//Full rehash of memory and the screen, after that writeMemory and DXYN keep it up to date
+void resetStateHash() {
+    memoryHash = 0;
+
+    for (int address = 0; address < MEMORY_SIZE; ++address) {
+        memoryHash ^= memoryCellHash(address, readMemory(address));
+    }
+
+    resetDisplayHash();
+}
+
+//Memory and screen come from the running hashes, the registers are small enough to just mix in every time
+uint64_t stateHash() {
+    uint64_t words[4];
+    uint64_t hash = mix64(memoryHash ^ mix64(displayHash));
+
+    memcpy(words, registers, sizeof(registers));
+    hash = mix64(hash ^ words[0]);
+    hash = mix64(hash ^ words[1]);
+
+    memcpy(words, stack, sizeof(stack));
+
+    for (int i = 0; i < 4; ++i) {
+        hash = mix64(hash ^ words[i]);
+    }
+
+    hash = mix64(hash ^ idx ^ ((uint64_t)pc << 16) ^ ((uint64_t)stackPointer << 32) ^ ((uint64_t)delayTimer << 40) ^ ((uint64_t)soundTimer << 48));
+    hash = mix64(hash ^ rngState ^ ((uint64_t)keypadMask(keys) << 32));
+
+    return hash;
+}
+
+/*
+Runs cycleBudget instructions with no window, feeding the keys from the input log as it goes.
+
+Between key changes the machine is a pure function of its state, so once a state comes round again it will keep going
+round the same loop forever. Every few instructions the state hash goes through Brent's cycle finding (tortoise stays
+put, hare moves, tortoise jumps to the hare at every power of two). Each time the tortoise jumps the gap between checks
+doubles up to HALT_CHECK_MAX_INTERVAL. The gap never changes while the tortoise sits still, so lambda checks is still
+exactly lambda * interval instructions. Once a loop of period instructions is found the run skips whole loops at a
+time, up to the next key change if there is one (then carries on normally) or up to the end of the budget (then stops
+with halt or livelock). The machine ends up exactly where the full run would have.
+
+FX0A waiting with no keys down and none coming is handled straight away, only the timers would still move.
+*/
+RunResult runHeadless(uint64_t cycleBudget, InputEvent const* events, int eventCount) {
+    RunResult result = { 0, 0, EXIT_BUDGET };
+    int nextEvent = 0;
+    bool searching = true;
+    uint64_t tortoise = 0;
+    uint64_t power = 1;
+    uint64_t lambda = 0;
+    int interval = HALT_CHECK_INTERVAL;
+    int sinceCheck = 0;
+
+    //Logs get reused with smaller budgets. Events the run never reaches would otherwise keep the input wait and final
+    //loop checks below thinking more input is coming
+    while (eventCount > 0 && events[eventCount - 1].cycle >= cycleBudget) {
+        --eventCount;
+    }
+
+    trackStateHash = true;
+    resetStateHash();
+
+    while (result.cycles < cycleBudget) {
+        if (nextEvent < eventCount && events[nextEvent].cycle <= result.cycles) {
+            while (nextEvent < eventCount && events[nextEvent].cycle <= result.cycles) {
+                keys[events[nextEvent].key] = events[nextEvent].pressed;
+                ++nextEvent;
+            }
+
+            //Different keys make it a different function so the search starts over
+            searching = true;
+            interval = HALT_CHECK_INTERVAL;
+            sinceCheck = interval;
+            lambda = 0;
+            power = 1;
+            tortoise = stateHash();
+        }
+
+        //Run straight up to the next loop check, key change or the end of the budget so the inner loop only has to
+        //look for faults and FX0A
+        uint64_t stop = cycleBudget;
+
+        if (nextEvent < eventCount && events[nextEvent].cycle < stop) {
+            stop = events[nextEvent].cycle;
+        }
+
+        if (searching && result.cycles + sinceCheck < stop) {
+            stop = result.cycles + sinceCheck;
+        }
+
+        uint64_t batchStart = result.cycles;
+        bool waitingForKey = false;
+
+        while (result.cycles < stop) {
+            fdeLoop();
+            ++result.cycles;
+
+            if (machineFault != FAULT_NONE) {
+                break;
+            }
+
+            if ((opcode & 0xF0FFu) == 0xF00Au) {
+                waitingForKey = true;
+                break;
+            }
+        }
+
+        result.executed += result.cycles - batchStart;
+
+        if (searching) {
+            sinceCheck -= (int)(result.cycles - batchStart);
+        }
+
+        if (machineFault != FAULT_NONE) {
+            result.reason = EXIT_FAULT;
+            break;
+        }
+
+        //FX0A put the pc back on itself, nothing is pressed and nothing ever will be
+        if (waitingForKey && nextEvent == eventCount && keypadMask(keys) == 0) {
+            uint64_t remaining = cycleBudget - result.cycles;
+
+            delayTimer = (delayTimer > remaining) ? delayTimer - remaining : 0;
+            soundTimer = (soundTimer > remaining) ? soundTimer - remaining : 0;
+            result.cycles = cycleBudget;
+            result.reason = EXIT_INPUT_WAIT;
+            break;
+        }
+
+        if (!searching || sinceCheck > 0) {
+            continue;
+        }
+
+        uint64_t hash = stateHash();
+        ++lambda;
+
+        if (hash != tortoise) {
+            if (power == lambda) {
+                tortoise = hash;
+                power *= 2;
+                lambda = 0;
+
+                if (interval < HALT_CHECK_MAX_INTERVAL) {
+                    interval *= 2;
+                }
+            }
+
+            sinceCheck = interval;
+            continue;
+        }
+
+        uint64_t period = lambda * interval;
+        bool finalLoop = nextEvent == eventCount;
+        uint64_t target = finalLoop ? cycleBudget : events[nextEvent].cycle;
+
+        result.cycles += (target - result.cycles) / period * period;
+
+        //Whatever is left is less than one loop, run it for real without looking for loops again
+        searching = false;
+
+        if (finalLoop) {
+            //Stuck on one instruction that jumps to itself, anything longer is a livelock
+            uint16_t nextOpcode = (readMemory(pc) << 8u) | readMemory(pc + 1);
+            bool selfJump = nextOpcode == (0x1000u | pc);
+            result.reason = selfJump ? EXIT_HALT : EXIT_LIVELOCK;
+        }
+    }
+
+    trackStateHash = false;
+
+    return result;
+}
+
+#define FNV_OFFSET 0xCBF29CE484222325ull
+
+//FNV-1a, feed the previous hash back in to keep adding to it
+uint64_t hashBytes(uint64_t hash, void const* data, size_t size) {
+    uint8_t const* bytes = (uint8_t const*)data;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+//Hash of the framebuffer so two runs can be compared without sending the whole screen around
+uint64_t hashDisplay() {
+    return hashBytes(FNV_OFFSET, display, sizeof(display));
+}
+
+//Machine snapshots
+
+/*
+Snapshots share memory pages with the machine instead of copying them, so saving bumps the page ref counts and
+whichever side writes to a page first gets its own copy. The state has to start zeroed (or from an earlier save)
+since whatever pages it held before get released.
+*/
+void saveState(MachineState* state) {
+    for (int i = 0; i < PAGE_COUNT; ++i) {
+        retainPage(memoryPages[i]);
+        releasePage(state->pages[i]);
+        state->pages[i] = memoryPages[i];
+    }
+
+    memcpy(state->display, display, sizeof(display));
+    memcpy(state->registers, registers, sizeof(registers));
+    memcpy(state->stack, stack, sizeof(stack));
+    state->keys = keypadMask(keys);
+    state->idx = idx;
+    state->pc = pc;
+    state->stackPointer = stackPointer;
+    state->delayTimer = delayTimer;
+    state->soundTimer = soundTimer;
+    state->rngState = rngState;
+}
+
+//Everything but the pages, those are up to loadState and takeState
+void loadRegisters(MachineState const* state) {
+    memcpy(display, state->display, sizeof(display));
+    memcpy(registers, state->registers, sizeof(registers));
+    memcpy(stack, state->stack, sizeof(stack));
+    setKeypad(state->keys);
+    idx = state->idx;
+    pc = state->pc;
+    stackPointer = state->stackPointer;
+    delayTimer = state->delayTimer;
+    soundTimer = state->soundTimer;
+    rngState = state->rngState;
+    displayDirty = true;
+}
+
+void loadState(MachineState const* state) {
+    for (int i = 0; i < PAGE_COUNT; ++i) {
+        retainPage(state->pages[i]);
+        releasePage(memoryPages[i]);
+        memoryPages[i] = state->pages[i];
+    }
+
+    loadRegisters(state);
+}
+
+//Like loadState but the machine takes over the state's pages and the state is left empty. For switching between
+//machines where the state is about to be saved over anyway, it keeps pages the machine owns from looking shared
+void takeState(MachineState* state) {
+    for (int i = 0; i < PAGE_COUNT; ++i) {
+        releasePage(memoryPages[i]);
+        memoryPages[i] = state->pages[i];
+        state->pages[i] = NULL;
+    }
+
+    loadRegisters(state);
+}
+
+//Field by field so struct padding never ends up in the hash
+uint64_t hashState(MachineState const* state) {
+    uint64_t hash = FNV_OFFSET;
+
+    for (int i = 0; i < PAGE_COUNT; ++i) {
+        hash = hashBytes(hash, state->pages[i]->bytes, PAGE_SIZE);
+    }
+
+    hash = hashBytes(hash, state->display, sizeof(state->display));
+    hash = hashBytes(hash, state->registers, sizeof(state->registers));
+    hash = hashBytes(hash, state->stack, sizeof(state->stack));
+    hash = hashBytes(hash, &state->keys, sizeof(state->keys));
+    hash = hashBytes(hash, &state->idx, sizeof(state->idx));
+    hash = hashBytes(hash, &state->pc, sizeof(state->pc));
+    hash = hashBytes(hash, &state->stackPointer, sizeof(state->stackPointer));
+    hash = hashBytes(hash, &state->delayTimer, sizeof(state->delayTimer));
+    hash = hashBytes(hash, &state->soundTimer, sizeof(state->soundTimer));
+    hash = hashBytes(hash, &state->rngState, sizeof(state->rngState));
+
+    return hash;
+}
+
+//Bit n of the mask is key n
+void setKeypad(uint16_t mask) {
+    for (int i = 0; i < 16; ++i) {
+        keys[i] = (mask >> i) & 1u;
+    }
+}
+
+uint16_t keypadMask(uint8_t const* keypad) {
+    uint16_t mask = 0;
+
+    for (int i = 0; i < 16; ++i) {
+        if (keypad[i]) {
+            mask |= 1u << i;
+        }
+    }
+
+    return mask;
+}
+
+void runFrame() {
+    for (int i = 0; i < CYCLES_PER_FRAME; ++i) {
+        fdeLoop();
+    }
+}
+
+/*
+Server mode boots everything once and then waits on a unix socket. Every connection gets its own fork so the child starts
+from the already set up tables and font (copy on write so nothing actually gets copied until the ROM goes in) and the parent
+never gets touched by a ROM. The child answers on the same connection and exits.
+
+Request (one line): <Rom> <Cycles> [InputLog or -] [Seed]
+Reply (one line):   ok cycles=<n> executed=<n> exit=<reason> hash=<framebuffer hash> pc=<pc> idx=<idx> registers=<V0..VF as hex> fault=<first fault or none>
+                    error <reason>
+*/
+void runServer(char const* socketPath) {
+    traceOpcodes = false;
+
+    initTables();
+    initMachine();
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (server < 0) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+
+    unlink(socketPath);
+
+    if (bind(server, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(server, 64) < 0) {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+
+    //Let the kernel reap finished children so the parent never has to wait on them
+    signal(SIGCHLD, SIG_IGN);
+
+    printf("Serving on %s\n", socketPath);
+    fflush(stdout);
+
+    while (true) {
+        int client = accept(server, NULL, NULL);
+
+        if (client < 0) {
+            continue;
+        }
+
+        pid_t child = fork();
+
+        if (child == 0) {
+            close(server);
+            serveRun(client);
+            _exit(0);
+        }
+
+        if (child < 0) {
+            dprintf(client, "error fork failed\n");
+        }
+
+        close(client);
+    }
+}
+
+//Runs inside the forked child. Reads one request, runs it and writes the result back
+void serveRun(int client) {
+    char request[1024];
+    size_t length = 0;
+
+    //The whole line almost always shows up in one go so this is usually a single recv. Anything after the newline is ignored
+    while (length < sizeof(request) - 1) {
+        ssize_t got = recv(client, request + length, sizeof(request) - 1 - length, 0);
+
+        if (got <= 0) {
+            break;
+        }
+
+        char* newline = memchr(request + length, '\n', got);
+        length += got;
+
+        if (newline != NULL) {
+            length = newline - request;
+            break;
+        }
+    }
+
+    request[length] = '\0';
+
+    char romName[512];
+    char inputLogName[512] = "-";
+    unsigned long long cycleBudget;
+    unsigned int seed = 0;
+
+    if (sscanf(request, "%511s %llu %511s %u", romName, &cycleBudget, inputLogName, &seed) < 2) {
+        dprintf(client, "error bad request\n");
+        return;
+    }
+
+    seedRandom(seed);
+
+    if (!loadROM(romName)) {
+        dprintf(client, "error couldn't load ROM %s\n", romName);
+        return;
+    }
+
+    static InputEvent events[MAX_INPUT_EVENTS];
+    int eventCount = 0;
+
+    if (strcmp(inputLogName, "-") != 0) {
+        eventCount = loadInputLog(inputLogName, events, MAX_INPUT_EVENTS);
+
+        if (eventCount < 0) {
+            dprintf(client, "error couldn't load input log %s\n", inputLogName);
+            return;
+        }
+    }
+
+    RunResult result = runHeadless(cycleBudget, events, eventCount);
+
+    char registerHex[16 * 2 + 1];
+
+    for (int i = 0; i < 16; ++i) {
+        sprintf(registerHex + i * 2, "%02X", registers[i]);
+    }
+
+    dprintf(client, "ok cycles=%llu executed=%llu exit=%s hash=%016llX pc=0x%03X idx=0x%03X registers=%s fault=%s\n",
+        (unsigned long long)result.cycles, (unsigned long long)result.executed, exitReasonName(result.reason),
+        (unsigned long long)hashDisplay(), pc, idx, registerHex, faultName(machineFault));
+}
+
+//Rollback netplay
+
+/*
+Both players run the whole game. Every frame each side sends its keypad over UDP and the two keypads get ORed together
+since two player ROMs just split the 16 keys between the players. The remote keypad for frames that haven't arrived yet
+is guessed (whatever they had pressed last) so the local side never has to wait. When the real input shows up and it
+doesn't match the guess, the machine goes back to the snapshot from the start of that frame and replays up to now with
+the right input. That all happens inside one host frame so the player only ever sees the corrected screen.
+
+A side can only get ROLLBACK_WINDOW - 1 frames ahead of what it knows about the other side, past that it stalls.
+Packets carry every input the other side hasn't acked yet so a lost packet doesn't matter, plus a hash of the newest
+frame that can't change anymore so both sides can check they haven't drifted apart.
+*/
+
+#define ROLLBACK_WINDOW 16
+#define NET_DELAY_QUEUE 256
+#define NO_FRAME 0xFFFFFFFFu
+
+typedef struct NetPacket {
+    uint32_t firstFrame;
+    uint32_t count;
+    uint32_t ackFrame;
+    uint32_t hashFrame;
+    uint32_t hashHigh;
+    uint32_t hashLow;
+    uint16_t inputs[ROLLBACK_WINDOW];
+} NetPacket;
+
+typedef struct Netplay {
+    int socket;
+    struct sockaddr_in remote;
+
+    //Next frame to simulate
+    uint32_t frame;
+    //Every remote input before this frame is known
+    uint32_t remoteConfirmed;
+    //The remote side has every local input before this frame
+    uint32_t remoteAck;
+    uint16_t lastRemoteInput;
+
+    //All of these are rings indexed by frame % ROLLBACK_WINDOW
+    uint16_t localInputs[ROLLBACK_WINDOW];
+    uint16_t remoteInputs[ROLLBACK_WINDOW];
+    uint32_t remoteInputFrames[ROLLBACK_WINDOW];
+    uint16_t usedRemoteInputs[ROLLBACK_WINDOW];
+    MachineState snapshots[ROLLBACK_WINDOW];
+
+    //Newest frame that can't be rolled back anymore and its hash, this is what goes out in every packet
+    uint32_t finalFrame;
+    uint64_t finalHash;
+
+    //Hashes of final frames, ours and theirs, also rings by frame. A frame gets compared as soon as both are in and
+    //checkedHashFrames remembers it so a resent packet with the same hash doesn't count twice
+    uint32_t localHashFrames[ROLLBACK_WINDOW];
+    uint64_t localHashes[ROLLBACK_WINDOW];
+    uint32_t remoteHashFrames[ROLLBACK_WINDOW];
+    uint64_t remoteHashes[ROLLBACK_WINDOW];
+    uint32_t checkedHashFrames[ROLLBACK_WINDOW];
+
+    //Loopback testing. Packets sit in the queue for latencyFrames host frames and lossPercent of them get dropped
+    int latencyFrames;
+    int lossPercent;
+    uint32_t lossRng;
+    uint32_t hostFrame;
+    NetPacket delayed[NET_DELAY_QUEUE];
+    uint32_t delayedUntil[NET_DELAY_QUEUE];
+    int delayedHead;
+    int delayedCount;
+
+    uint64_t rollbacks;
+    uint64_t resimulatedFrames;
+    uint32_t maxRollbackDepth;
+    uint64_t rollbackNanos;
+    uint64_t stalls;
+    uint64_t hashChecks;
+    uint64_t desyncs;
+} Netplay;
+
+uint64_t nanoTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+//Non blocking UDP socket. Port 0 lets the kernel pick one
+int openNetplaySocket(int port, bool loopbackOnly) {
+    int udp = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (udp < 0) {
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+
+    if (bind(udp, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(udp);
+        return -1;
+    }
+
+    fcntl(udp, F_SETFL, fcntl(udp, F_GETFL) | O_NONBLOCK);
+
+    return udp;
+}
+
+void initNetplay(Netplay* netplay, int udp, struct sockaddr_in const* remote) {
+    memset(netplay, 0, sizeof(Netplay));
+    netplay->socket = udp;
+    netplay->remote = *remote;
+    netplay->finalFrame = NO_FRAME;
+    netplay->lossRng = 0x9E3779B9u;
+
+    for (int i = 0; i < ROLLBACK_WINDOW; ++i) {
+        netplay->remoteInputFrames[i] = NO_FRAME;
+        netplay->localHashFrames[i] = NO_FRAME;
+        netplay->remoteHashFrames[i] = NO_FRAME;
+        netplay->checkedHashFrames[i] = NO_FRAME;
+    }
+}
+
+//Runs one frame with the local input and either the real remote input or the guess
+void netplaySimulate(Netplay* netplay, uint32_t frame) {
+    int slot = frame % ROLLBACK_WINDOW;
+    uint16_t remoteInput = (netplay->remoteInputFrames[slot] == frame) ? netplay->remoteInputs[slot] : netplay->lastRemoteInput;
+
+    netplay->usedRemoteInputs[slot] = remoteInput;
+    setKeypad(netplay->localInputs[slot] | remoteInput);
+    runFrame();
+}
+
+//Go back to the start of frame from and replay everything up to the current frame
+void netplayRollback(Netplay* netplay, uint32_t from) {
+    uint64_t start = nanoTime();
+
+    loadState(&netplay->snapshots[from % ROLLBACK_WINDOW]);
+
+    for (uint32_t frame = from; frame < netplay->frame; ++frame) {
+        if (frame != from) {
+            saveState(&netplay->snapshots[frame % ROLLBACK_WINDOW]);
+        }
+
+        netplaySimulate(netplay, frame);
+    }
+
+    uint32_t depth = netplay->frame - from;
+
+    ++netplay->rollbacks;
+    netplay->resimulatedFrames += depth;
+    netplay->rollbackNanos += nanoTime() - start;
+
+    if (depth > netplay->maxRollbackDepth) {
+        netplay->maxRollbackDepth = depth;
+    }
+}
+
+//Counts a desync if both sides have a hash for frame and they don't match. Each frame only gets compared once
+void netplayCompareHash(Netplay* netplay, uint32_t frame) {
+    int slot = frame % ROLLBACK_WINDOW;
+
+    if (netplay->localHashFrames[slot] != frame || netplay->remoteHashFrames[slot] != frame || netplay->checkedHashFrames[slot] == frame) {
+        return;
+    }
+
+    netplay->checkedHashFrames[slot] = frame;
+    ++netplay->hashChecks;
+
+    if (netplay->localHashes[slot] != netplay->remoteHashes[slot]) {
+        ++netplay->desyncs;
+        printf("Desync at frame %u\n", frame);
+    }
+}
+
+//Takes in every waiting packet and rolls back once to the oldest frame that was guessed wrong
+void netplayReceive(Netplay* netplay) {
+    NetPacket packet;
+    uint32_t rollbackFrom = NO_FRAME;
+
+    while (recv(netplay->socket, &packet, sizeof(packet), 0) == sizeof(packet)) {
+        uint32_t firstFrame = ntohl(packet.firstFrame);
+        uint32_t count = ntohl(packet.count);
+        uint32_t ackFrame = ntohl(packet.ackFrame);
+        uint32_t hashFrame = ntohl(packet.hashFrame);
+
+        if (count > ROLLBACK_WINDOW) {
+            continue;
+        }
+
+        if (ackFrame > netplay->remoteAck && ackFrame <= netplay->frame) {
+            netplay->remoteAck = ackFrame;
+        }
+
+        if (hashFrame != NO_FRAME) {
+            int slot = hashFrame % ROLLBACK_WINDOW;
+            uint32_t held = netplay->remoteHashFrames[slot];
+
+            //Skip ones already compared and ones so old a newer frame has their slot
+            if (netplay->checkedHashFrames[slot] != hashFrame && (held == NO_FRAME || hashFrame > held)) {
+                netplay->remoteHashFrames[slot] = hashFrame;
+                netplay->remoteHashes[slot] = ((uint64_t)ntohl(packet.hashHigh) << 32) | ntohl(packet.hashLow);
+                netplayCompareHash(netplay, hashFrame);
+            }
+        }
+
+        //The other side can be ahead of us, slots for frames we haven't run yet can't get reused before we run them
+        uint32_t oldestSlot = (netplay->remoteConfirmed < netplay->frame) ? netplay->remoteConfirmed : netplay->frame;
+
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t frame = firstFrame + i;
+            int slot = frame % ROLLBACK_WINDOW;
+
+            //Already known or too far ahead to have a slot
+            if (frame < netplay->remoteConfirmed || frame >= oldestSlot + ROLLBACK_WINDOW || netplay->remoteInputFrames[slot] == frame) {
+                continue;
+            }
+
+            netplay->remoteInputs[slot] = ntohs(packet.inputs[i]);
+            netplay->remoteInputFrames[slot] = frame;
+
+            if (frame < netplay->frame && netplay->remoteInputs[slot] != netplay->usedRemoteInputs[slot] && frame < rollbackFrom) {
+                rollbackFrom = frame;
+            }
+        }
+
+        while (netplay->remoteInputFrames[netplay->remoteConfirmed % ROLLBACK_WINDOW] == netplay->remoteConfirmed) {
+            netplay->lastRemoteInput = netplay->remoteInputs[netplay->remoteConfirmed % ROLLBACK_WINDOW];
+            ++netplay->remoteConfirmed;
+        }
+    }
+
+    if (rollbackFrom != NO_FRAME) {
+        netplayRollback(netplay, rollbackFrom);
+    }
+}
+
+/*
+The snapshot at the start of a frame is final once every input before it is known. Every frame that goes final gets
+hashed into the ring and compared against whatever hash the other side sent for it, whichever of the two shows up
+second does the compare. The other side sends its newest final frame in every packet, so a drift shows up within
+about one round trip instead of only when both sides happen to be on the same final frame.
+*/
+void netplayCheckHashes(Netplay* netplay) {
+    if (netplay->frame == 0) {
+        return;
+    }
+
+    uint32_t finalFrame = (netplay->remoteConfirmed < netplay->frame - 1) ? netplay->remoteConfirmed : netplay->frame - 1;
+
+    if (finalFrame == netplay->finalFrame) {
+        return;
+    }
+
+    uint32_t first = (netplay->finalFrame == NO_FRAME) ? 0 : netplay->finalFrame + 1;
+
+    //Only the last ROLLBACK_WINDOW snapshots are still around
+    if (netplay->frame > ROLLBACK_WINDOW && first < netplay->frame - ROLLBACK_WINDOW) {
+        first = netplay->frame - ROLLBACK_WINDOW;
+    }
+
+    for (uint32_t frame = first; frame <= finalFrame; ++frame) {
+        int slot = frame % ROLLBACK_WINDOW;
+
+        netplay->localHashFrames[slot] = frame;
+        netplay->localHashes[slot] = hashState(&netplay->snapshots[slot]);
+        netplayCompareHash(netplay, frame);
+    }
+
+    netplay->finalFrame = finalFrame;
+    netplay->finalHash = netplay->localHashes[finalFrame % ROLLBACK_WINDOW];
+}
+
+bool netplayCanAdvance(Netplay* netplay) {
+    bool remoteCloseEnough = netplay->frame < netplay->remoteConfirmed || netplay->frame - netplay->remoteConfirmed < ROLLBACK_WINDOW - 1;
+
+    return remoteCloseEnough && netplay->frame - netplay->remoteAck < ROLLBACK_WINDOW - 1;
+}
+
+void netplayAdvance(Netplay* netplay, uint16_t localInput) {
+    int slot = netplay->frame % ROLLBACK_WINDOW;
+
+    netplay->localInputs[slot] = localInput;
+    saveState(&netplay->snapshots[slot]);
+    netplaySimulate(netplay, netplay->frame);
+    ++netplay->frame;
+}
+
+void netplaySend(Netplay* netplay) {
+    NetPacket packet;
+    uint32_t count = netplay->frame - netplay->remoteAck;
+
+    memset(&packet, 0, sizeof(packet));
+    packet.firstFrame = htonl(netplay->remoteAck);
+    packet.count = htonl(count);
+    packet.ackFrame = htonl(netplay->remoteConfirmed);
+    packet.hashFrame = htonl(netplay->finalFrame);
+    packet.hashHigh = htonl(netplay->finalHash >> 32);
+    packet.hashLow = htonl(netplay->finalHash & 0xFFFFFFFFu);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        packet.inputs[i] = htons(netplay->localInputs[(netplay->remoteAck + i) % ROLLBACK_WINDOW]);
+    }
+
+    if (netplay->latencyFrames == 0 && netplay->lossPercent == 0) {
+        sendto(netplay->socket, &packet, sizeof(packet), 0, (struct sockaddr*)&netplay->remote, sizeof(netplay->remote));
+        return;
+    }
+
+    //Same xorshift as randByte but on its own state so it never touches the machine
+    netplay->lossRng ^= netplay->lossRng << 13;
+    netplay->lossRng ^= netplay->lossRng >> 17;
+    netplay->lossRng ^= netplay->lossRng << 5;
+
+    if (netplay->lossRng % 100 < netplay->lossPercent || netplay->delayedCount == NET_DELAY_QUEUE) {
+        return;
+    }
+
+    int slot = (netplay->delayedHead + netplay->delayedCount) % NET_DELAY_QUEUE;
+    netplay->delayed[slot] = packet;
+    netplay->delayedUntil[slot] = netplay->hostFrame + netplay->latencyFrames;
+    ++netplay->delayedCount;
+}
+
+//Sends whatever delayed packets are due and moves the host frame along
+void netplayFlush(Netplay* netplay) {
+    ++netplay->hostFrame;
+
+    while (netplay->delayedCount > 0 && netplay->delayedUntil[netplay->delayedHead] <= netplay->hostFrame) {
+        sendto(netplay->socket, &netplay->delayed[netplay->delayedHead], sizeof(NetPacket), 0, (struct sockaddr*)&netplay->remote, sizeof(netplay->remote));
+        netplay->delayedHead = (netplay->delayedHead + 1) % NET_DELAY_QUEUE;
+        --netplay->delayedCount;
+    }
+}
+
+//One host frame. Stops advancing once lastFrame is reached but keeps talking so the other side can finish. Returns true if a frame ran
+bool netplayStep(Netplay* netplay, uint16_t localInput, uint32_t lastFrame) {
+    bool advanced = false;
+
+    netplayReceive(netplay);
+    netplayCheckHashes(netplay);
+
+    if (netplay->frame < lastFrame) {
+        if (netplayCanAdvance(netplay)) {
+            netplayAdvance(netplay, localInput);
+            advanced = true;
+        } else {
+            ++netplay->stalls;
+        }
+    }
+
+    netplaySend(netplay);
+    netplayFlush(netplay);
+
+    return advanced;
+}
+
+void printNetplayStats(char const* name, Netplay const* netplay) {
+    double averageDepth = netplay->rollbacks ? (double)netplay->resimulatedFrames / netplay->rollbacks : 0.0;
+    double averageMicros = netplay->rollbacks ? netplay->rollbackNanos / 1000.0 / netplay->rollbacks : 0.0;
+
+    printf("%s: frames=%u rollbacks=%llu maxDepth=%u avgDepth=%.2f avgRollbackUs=%.2f stalls=%llu hashChecks=%llu desyncs=%llu\n",
+        name, netplay->frame, (unsigned long long)netplay->rollbacks, netplay->maxRollbackDepth, averageDepth, averageMicros,
+        (unsigned long long)netplay->stalls, (unsigned long long)netplay->hashChecks, (unsigned long long)netplay->desyncs);
+}
+
+//Both players have to use the same ROM and seed. Runs at 60 frames a second with the normal window and keys
+void runNetplay(int videoScale, char const* romName, int localPort, char const* remoteHost, int remotePort, uint32_t seed) {
+    traceOpcodes = false;
+
+    struct sockaddr_in remote;
+    memset(&remote, 0, sizeof(remote));
+    remote.sin_family = AF_INET;
+    remote.sin_port = htons(remotePort);
+
+    if (inet_pton(AF_INET, remoteHost, &remote.sin_addr) != 1) {
+        printf("Bad remote address %s\n", remoteHost);
+        exit(EXIT_FAILURE);
+    }
+
+    int udp = openNetplaySocket(localPort, false);
+
+    if (udp < 0) {
+        printf("Couldn't bind port %d\n", localPort);
+        exit(EXIT_FAILURE);
+    }
+
+    initSDL("CHIP8 Emulator (netplay)", SCREEN_WIDTH * videoScale, SCREEN_HEIGHT * videoScale, SCREEN_WIDTH, SCREEN_HEIGHT);
+    initTables();
+    initMachine();
+    seedRandom(seed);
+
+    if (!loadROM(romName)) {
+        printf("Couldn't load ROM %s\n", romName);
+        exit(EXIT_FAILURE);
+    }
+
+    static Netplay netplay;
+    initNetplay(&netplay, udp, &remote);
+
+    uint8_t localKeys[16] = { 0 };
+    int pitch = sizeof(uint32_t) * SCREEN_WIDTH;
+    uint32_t nextFrameTime = SDL_GetTicks();
+    bool shouldStop = false;
+
+    while (!shouldStop) {
+        shouldStop = proccessInput(localKeys);
+
+        if (SDL_GetTicks() < nextFrameTime) {
+            SDL_Delay(1);
+            continue;
+        }
+
+        nextFrameTime += 1000 / 60;
+
+        netplayStep(&netplay, keypadMask(localKeys), NO_FRAME);
+        updateDisplay(display, pitch);
+        publishState();
+    }
+
+    printNetplayStats("local", &netplay);
+}
+
+typedef struct NetplayTestResult {
+    int player;
+    uint64_t hash;
+    uint64_t desyncs;
+} NetplayTestResult;
+
+//One side of the loopback test, runs in its own process
+void runNetplayTestPlayer(int player, int udp, struct sockaddr_in const* remote, uint32_t frames, int latencyFrames, int lossPercent, int resultPipe) {
+    static Netplay netplay;
+    initNetplay(&netplay, udp, remote);
+    netplay.latencyFrames = latencyFrames;
+    netplay.lossPercent = lossPercent;
+    netplay.lossRng = 0x2545F491u * (player + 1);
+
+    seedRandom(1234);
+
+    //Scripted keypad, player 0 only presses keys 0-7 and player 1 keys 8-F
+    uint32_t inputRng = 0x1234567u * (player + 1);
+    uint16_t input = 0;
+    uint64_t lastProgress = nanoTime();
+    uint64_t lastPosition = 0;
+
+    while (netplay.frame < frames || netplay.remoteConfirmed < frames || netplay.remoteAck < frames) {
+        inputRng ^= inputRng << 13;
+        inputRng ^= inputRng >> 17;
+        inputRng ^= inputRng << 5;
+
+        if ((inputRng & 7) == 0) {
+            input = ((inputRng >> 8) & 1) ? 0 : (uint16_t)((1u << ((inputRng >> 16) % 8)) << (player * 8));
+        }
+
+        netplayStep(&netplay, input, frames);
+
+        uint64_t position = (uint64_t)netplay.frame + netplay.remoteConfirmed + netplay.remoteAck;
+
+        if (position != lastPosition) {
+            lastPosition = position;
+            lastProgress = nanoTime();
+        } else if (nanoTime() - lastProgress > 5000000000ull) {
+            printf("player %d: no progress for 5s, giving up\n", player);
+            fflush(stdout);
+            _exit(EXIT_FAILURE);
+        } else {
+            usleep(100);
+        }
+    }
+
+    //Hang around a bit so our last acks make it through the delay queue to the other side
+    for (int i = 0; i < latencyFrames + 100; ++i) {
+        netplayStep(&netplay, input, frames);
+        usleep(100);
+    }
+
+    static MachineState finalState;
+    saveState(&finalState);
+
+    char name[16];
+    sprintf(name, "player %d", player);
+    printNetplayStats(name, &netplay);
+    fflush(stdout);
+
+    NetplayTestResult result = { player, hashState(&finalState), netplay.desyncs };
+
+    //The parent treats a missing result as a player that didn't finish
+    if (write(resultPipe, &result, sizeof(result)) != sizeof(result)) {
+        perror("write result");
+        _exit(EXIT_FAILURE);
+    }
+}
+
+/*
+Runs both players on this machine over loopback UDP with latencyFrames of delay and lossPercent packet loss in each
+direction, then checks both ended up with the exact same machine state.
+*/
+void runNetplayTest(char const* romName, uint32_t frames, int latencyFrames, int lossPercent) {
+    traceOpcodes = false;
+
+    initTables();
+    initMachine();
+
+    if (!loadROM(romName)) {
+        printf("Couldn't load ROM %s\n", romName);
+        exit(EXIT_FAILURE);
+    }
+
+    int sockets[2];
+    struct sockaddr_in addresses[2];
+
+    for (int i = 0; i < 2; ++i) {
+        sockets[i] = openNetplaySocket(0, true);
+        socklen_t length = sizeof(addresses[i]);
+
+        if (sockets[i] < 0 || getsockname(sockets[i], (struct sockaddr*)&addresses[i], &length) < 0) {
+            perror("socket");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int resultPipe[2];
+
+    if (pipe(resultPipe) < 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t children[2];
+
+    for (int player = 0; player < 2; ++player) {
+        children[player] = fork();
+
+        if (children[player] == 0) {
+            close(resultPipe[0]);
+            close(sockets[1 - player]);
+            runNetplayTestPlayer(player, sockets[player], &addresses[1 - player], frames, latencyFrames, lossPercent, resultPipe[1]);
+            _exit(0);
+        }
+    }
+
+    close(resultPipe[1]);
+
+    NetplayTestResult results[2];
+    int received = 0;
+    NetplayTestResult result;
+
+    while (received < 2 && read(resultPipe[0], &result, sizeof(result)) == sizeof(result)) {
+        results[result.player & 1] = result;
+        ++received;
+    }
+
+    for (int player = 0; player < 2; ++player) {
+        waitpid(children[player], NULL, 0);
+    }
+
+    if (received != 2) {
+        printf("A player didn't finish\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool inSync = results[0].hash == results[1].hash && results[0].desyncs == 0 && results[1].desyncs == 0;
+
+    printf("final hashes %016llX %016llX: %s\n", (unsigned long long)results[0].hash, (unsigned long long)results[1].hash, inSync ? "in sync" : "DESYNC");
+
+    if (!inSync) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+//Run-ahead
+
+/*
+ROMs usually only look at the keys once a frame or so and then take another frame to draw the result, so a key press
+shows up a frame or two late. Run-ahead hides that by running the real frame, saving, running aheadFrames more frames
+with the keys as they are right now and showing that future screen, then putting the real state back. The player sees
+what the screen will look like aheadFrames from now, which is when their input would have shown up anyway.
+
+The speculation has to fit inside a 60Hz frame, so the save, the extra frames and the restore get timed and reported.
+*/
+
+#define FRAME_MILLIS (1000 / 60)
+
+void printRunAheadStats(int aheadFrames, uint64_t frames, uint64_t totalNanos, uint64_t maxNanos) {
+    double averageMicros = frames ? totalNanos / 1000.0 / frames : 0.0;
+
+    printf("run-ahead %d: %llu frames, speculation avg %.2fus max %.2fus (%.3f%% of a %dms frame)\n",
+        aheadFrames, (unsigned long long)frames, averageMicros, maxNanos / 1000.0, averageMicros / (FRAME_MILLIS * 10.0), FRAME_MILLIS);
+}
+
+void runRunAhead(int videoScale, char const* romName, int aheadFrames, char const* shmName) {
+    traceOpcodes = false;
+
+    if (shmName != NULL && !createSharedState(shmName)) {
+        printf("Couldn't create shared memory %s\n", shmName);
+        exit(EXIT_FAILURE);
+    }
+
+    initSDL("CHIP8 Emulator (run-ahead)", SCREEN_WIDTH * videoScale, SCREEN_HEIGHT * videoScale, SCREEN_WIDTH, SCREEN_HEIGHT);
+    initTables();
+    initMachine();
+
+    if (!loadROM(romName)) {
+        printf("Couldn't load ROM %s\n", romName);
+        exit(EXIT_FAILURE);
+    }
+
+    static MachineState realState;
+    int pitch = sizeof(uint32_t) * SCREEN_WIDTH;
+    uint32_t nextFrameTime = SDL_GetTicks();
+    uint32_t nextReportTime = nextFrameTime + 5000;
+    uint64_t frames = 0;
+    uint64_t totalNanos = 0;
+    uint64_t maxNanos = 0;
+    bool shouldStop = false;
+
+    while (!shouldStop) {
+        shouldStop = proccessInput(keys);
+
+        uint32_t currentTime = SDL_GetTicks();
+
+        if (currentTime < nextFrameTime) {
+            SDL_Delay(1);
+            continue;
+        }
+
+        nextFrameTime += FRAME_MILLIS;
+
+        runFrame();
+
+        uint64_t start = nanoTime();
+
+        saveState(&realState);
+
+        for (int i = 0; i < aheadFrames; ++i) {
+            runFrame();
+        }
+
+        uint64_t speculationNanos = nanoTime() - start;
+
+        updateDisplay(display, pitch);
+        publishState();
+
+        start = nanoTime();
+        loadState(&realState);
+        speculationNanos += nanoTime() - start;
+
+        ++frames;
+        totalNanos += speculationNanos;
+
+        if (speculationNanos > maxNanos) {
+            maxNanos = speculationNanos;
+        }
+
+        if (currentTime >= nextReportTime) {
+            nextReportTime = currentTime + 5000;
+            printRunAheadStats(aheadFrames, frames, totalNanos, maxNanos);
+        }
+    }
+
+    printRunAheadStats(aheadFrames, frames, totalNanos, maxNanos);
+
+    if (shmName != NULL) {
+        shm_unlink(shmName);
+    }
+}
+
+//Fleet
+
+/*
+Runs lots of machines on the same ROM round robin in one process. Booting once and saving gives the shared ROM image,
+every machine starts as a copy of that snapshot so they all point at the same font and ROM pages and only get private
+pages for what they write. Switching machines is takeState then saveState, no 4KB copies anywhere.
+*/
+
+#define FLEET_SLICE 1000
+
+void runFleet(uint32_t count, uint64_t cycles, char const* romName) {
+    traceOpcodes = false;
+
+    initTables();
+    initMachine();
+
+    if (!loadROM(romName)) {
+        printf("Couldn't load ROM %s\n", romName);
+        exit(EXIT_FAILURE);
+    }
+
+    static MachineState romImage;
+    saveState(&romImage);
+
+    MachineState* machines = (MachineState*)aligned_alloc(64, count * sizeof(MachineState));
+
+    if (machines == NULL) {
+        printf("Couldn't allocate %u machines\n", count);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(machines, 0, count * sizeof(MachineState));
+
+    for (uint32_t i = 0; i < count; ++i) {
+        loadState(&romImage);
+        seedRandom(i + 1);
+        saveState(&machines[i]);
+    }
+
+    uint64_t start = nanoTime();
+
+    for (uint64_t done = 0; done < cycles; done += FLEET_SLICE) {
+        uint64_t slice = (cycles - done < FLEET_SLICE) ? cycles - done : FLEET_SLICE;
+
+        for (uint32_t i = 0; i < count; ++i) {
+            takeState(&machines[i]);
+
+            for (uint64_t cycle = 0; cycle < slice; ++cycle) {
+                fdeLoop();
+            }
+
+            saveState(&machines[i]);
+        }
+    }
+
+    double seconds = (nanoTime() - start) / 1e9;
+
+    //Anything that isn't the ROM image's page is one the machine wrote to and owns
+    uint64_t privatePages = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        for (int page = 0; page < PAGE_COUNT; ++page) {
+            if (machines[i].pages[page] != romImage.pages[page]) {
+                ++privatePages;
+            }
+        }
+    }
+
+    double bytesPerMachine = sizeof(MachineState) + (double)privatePages * sizeof(MemoryPage) / count;
+
+    printf("%u machines, %llu cycles each: %.2fs, %.1fM instructions/s\n", count, (unsigned long long)cycles, seconds, count * (double)cycles / seconds / 1e6);
+    printf("state %zu bytes, %llu private pages, %.0f bytes per machine\n", sizeof(MachineState), (unsigned long long)privatePages, bytesPerMachine);
+}
+
+//Fuzzer
+
+/*
+Coverage guided fuzzing of keypad input and RNG seeds, all in one process. A fuzz input is a seed plus a keypad for
+every frame. Each run resets the machine from the boot snapshot (16 page pointers and the registers, no loadROM), plays
+the input, and records which PCs and which PC to PC edges it hit. Inputs that hit something new go in the corpus and
+get mutated further, inputs that fault get saved once per fault kind and address.
+
+Saved inputs are normal input logs with the seed in a comment so they can be replayed through the server:
+    <Rom> <Frames * CYCLES_PER_FRAME> <SavedLog> <Seed>
+*/
+
+#define MAX_FUZZ_FRAMES 1024
+#define MAX_CORPUS 4096
+#define EDGE_MAP_SIZE 65536
+
+typedef struct FuzzInput {
+    uint32_t seed;
+    uint16_t keypad[MAX_FUZZ_FRAMES];
+} FuzzInput;
+
+//This run's coverage and everything seen so far, one bit per PC and one per (hashed) edge. Bits keep the
+//per run clear and merge down to 1KB so they don't eat into the runs per second
+uint64_t pcCoverage[MEMORY_SIZE / 64];
+uint64_t edgeCoverage[EDGE_MAP_SIZE / 64];
+uint64_t seenPcCoverage[MEMORY_SIZE / 64];
+uint64_t seenEdgeCoverage[EDGE_MAP_SIZE / 64];
+uint16_t previousPc;
+
+//Called from fdeLoop before every instruction while coverageEnabled is set
+void recordCoverage() {
+    uint16_t location = pc & 0xFFFu;
+    uint16_t edge = (previousPc * 0x9E37u) ^ location;
+
+    pcCoverage[location >> 6] |= 1ull << (location & 63u);
+    edgeCoverage[edge >> 6] |= 1ull << (edge & 63u);
+    previousPc = location;
+}
+
+//Folds one run's bits into the seen bits and returns how many were new
+uint32_t mergeBits(uint64_t const* run, uint64_t* seen, int words) {
+    uint32_t found = 0;
+
+    for (int i = 0; i < words; ++i) {
+        uint64_t fresh = run[i] & ~seen[i];
+
+        if (fresh) {
+            seen[i] |= fresh;
+            found += __builtin_popcountll(fresh);
+        }
+    }
+
+    return found;
+}
+
+//Says if this run hit anything new
+bool mergeCoverage(uint32_t* pcCount, uint32_t* edgeCount) {
+    uint32_t newPcs = mergeBits(pcCoverage, seenPcCoverage, MEMORY_SIZE / 64);
+    uint32_t newEdges = mergeBits(edgeCoverage, seenEdgeCoverage, EDGE_MAP_SIZE / 64);
+
+    *pcCount += newPcs;
+    *edgeCount += newEdges;
+
+    return newPcs + newEdges > 0;
+}
+
+uint32_t fuzzRandom(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+
+    return *state;
+}
+
+//Stacks 1-4 random edits on top of each other
+void mutateFuzzInput(FuzzInput* input, int frames, uint32_t* rng) {
+    int edits = 1 + fuzzRandom(rng) % 4;
+
+    for (int edit = 0; edit < edits; ++edit) {
+        int frame = fuzzRandom(rng) % frames;
+        int length = 1 + fuzzRandom(rng) % 16;
+
+        switch (fuzzRandom(rng) % 5) {
+            case 0:
+                //Flip one key in one frame
+                input->keypad[frame] ^= 1u << (fuzzRandom(rng) % 16);
+                break;
+            case 1: {
+                //Hold one key down (or nothing) for a while
+                uint16_t mask = (fuzzRandom(rng) & 1) ? 1u << (fuzzRandom(rng) % 16) : 0;
+
+                for (int i = frame; i < frame + length && i < frames; ++i) {
+                    input->keypad[i] = mask;
+                }
+                break;
+            }
+            case 2:
+                //Random keypad for a while
+                for (int i = frame; i < frame + length && i < frames; ++i) {
+                    input->keypad[i] = fuzzRandom(rng);
+                }
+                break;
+            case 3: {
+                //Copy a stretch from somewhere else
+                int from = fuzzRandom(rng) % frames;
+
+                for (int i = 0; i < length && frame + i < frames && from + i < frames; ++i) {
+                    input->keypad[frame + i] = input->keypad[from + i];
+                }
+                break;
+            }
+            default:
+                input->seed = fuzzRandom(rng);
+                break;
+        }
+    }
+}
+
+MachineFault runFuzzInput(MachineState const* bootState, FuzzInput const* input, int frames) {
+    loadState(bootState);
+    seedRandom(input->seed);
+    machineFault = FAULT_NONE;
+    previousPc = 0;
+    memset(pcCoverage, 0, sizeof(pcCoverage));
+    memset(edgeCoverage, 0, sizeof(edgeCoverage));
+
+    for (int frame = 0; frame < frames; ++frame) {
+        setKeypad(input->keypad[frame]);
+
+        for (int cycle = 0; cycle < CYCLES_PER_FRAME; ++cycle) {
+            fdeLoop();
+
+            if (machineFault != FAULT_NONE) {
+                return machineFault;
+            }
+        }
+    }
+
+    return FAULT_NONE;
+}
+
+//Written as an input log, only the frames where a key changes end up in it
+void saveFuzzInput(char const* path, FuzzInput const* input, int frames, MachineFault fault) {
+    FILE* file = fopen(path, "w");
+
+    if (file == NULL) {
+        return;
+    }
+
+    fprintf(file, "# seed %u\n", input->seed);
+    fprintf(file, "# cycles %d\n", frames * CYCLES_PER_FRAME);
+
+    if (fault != FAULT_NONE) {
+        fprintf(file, "# fault %s at 0x%03X\n", faultName(fault), faultAddress);
+    }
+
+    uint16_t previous = 0;
+
+    for (int frame = 0; frame < frames; ++frame) {
+        uint16_t changed = input->keypad[frame] ^ previous;
+
+        for (int key = 0; key < 16; ++key) {
+            if (changed & (1u << key)) {
+                fprintf(file, "%d %X %d\n", frame * CYCLES_PER_FRAME, key, (input->keypad[frame] >> key) & 1);
+            }
+        }
+
+        previous = input->keypad[frame];
+    }
+
+    fclose(file);
+}
+
+void printFuzzStats(uint64_t runs, double seconds, int corpusSize, uint32_t pcCount, uint32_t edgeCount, int crashes) {
+    printf("runs %llu (%.0f/s) corpus %d pcs %u edges %u crashes %d\n",
+        (unsigned long long)runs, runs / seconds, corpusSize, pcCount, edgeCount, crashes);
+    fflush(stdout);
+}
+
+void runFuzzer(char const* romName, char const* corpusDir, uint64_t runs, int frames) {
+    traceOpcodes = false;
+
+    if (frames < 1 || frames > MAX_FUZZ_FRAMES) {
+        printf("Frames has to be between 1 and %d\n", MAX_FUZZ_FRAMES);
+        exit(EXIT_FAILURE);
+    }
+
+    if (mkdir(corpusDir, 0755) < 0 && errno != EEXIST) {
+        perror("mkdir");
+        exit(EXIT_FAILURE);
+    }
+
+    initTables();
+    initMachine();
+
+    if (!loadROM(romName)) {
+        printf("Couldn't load ROM %s\n", romName);
+        exit(EXIT_FAILURE);
+    }
+
+    static MachineState bootState;
+    saveState(&bootState);
+
+    static FuzzInput corpus[MAX_CORPUS];
+    int corpusSize = 1;
+    memset(&corpus[0], 0, sizeof(FuzzInput));
+    corpus[0].seed = 1;
+
+    //One bit per fault kind and address so each crash only gets saved once
+    static uint8_t seenCrashes[FAULT_PC_BOUNDS + 1][MEMORY_SIZE / 8];
+    int crashes = 0;
+
+    uint32_t pcCount = 0;
+    uint32_t edgeCount = 0;
+    uint32_t rng = (uint32_t)time(NULL) | 1u;
+    char path[1024];
+    FuzzInput input;
+
+    coverageEnabled = true;
+
+    uint64_t start = nanoTime();
+    uint64_t nextReport = start + 1000000000ull;
+    uint64_t run;
+
+    for (run = 0; run < runs; ++run) {
+        input = corpus[fuzzRandom(&rng) % corpusSize];
+
+        //The very first run plays the blank input as is so the baseline coverage gets in
+        if (run > 0) {
+            mutateFuzzInput(&input, frames, &rng);
+        }
+
+        MachineFault fault = runFuzzInput(&bootState, &input, frames);
+        bool newCoverage = mergeCoverage(&pcCount, &edgeCount);
+
+        if (fault != FAULT_NONE) {
+            uint8_t* seen = &seenCrashes[fault][(faultAddress & 0xFFFu) >> 3];
+            uint8_t bit = 1u << (faultAddress & 7u);
+
+            if (!(*seen & bit)) {
+                *seen |= bit;
+                ++crashes;
+                snprintf(path, sizeof(path), "%s/crash-%s-%03X.log", corpusDir, faultName(fault), faultAddress & 0xFFFu);
+                saveFuzzInput(path, &input, frames, fault);
+            }
+        } else if (newCoverage && corpusSize < MAX_CORPUS) {
+            corpus[corpusSize] = input;
+            snprintf(path, sizeof(path), "%s/cov-%04d.log", corpusDir, corpusSize);
+            saveFuzzInput(path, &input, frames, FAULT_NONE);
+            ++corpusSize;
+        }
+
+        //Checking the clock every run would show up in the runs per second
+        if ((run & 0x3FFu) == 0 && nanoTime() >= nextReport) {
+            nextReport += 1000000000ull;
+            printFuzzStats(run + 1, (nanoTime() - start) / 1e9, corpusSize, pcCount, edgeCount, crashes);
+        }
+    }
+
+    coverageEnabled = false;
+
+    printFuzzStats(run, (nanoTime() - start) / 1e9, corpusSize, pcCount, edgeCount, crashes);
+}
+
+//Corpus runner
+
+/*
+Runs a whole ROM corpus headless on every core and streams one JSON line per ROM to a report. The machine lives in
+globals so each worker is a forked process, they share the job list (copy on write, never written) and a mapped
+block with the work queues and stats.
+
+Scheduling is work stealing. Every worker starts with its own run of jobs and takes from the back of it. When it runs
+out it steals from the front of someone else's, so the worker that got stuck with a long ROM has its queued jobs
+taken by whoever is free and nobody sits idle while work is left.
+
+If a worker dies the ROM it was running gets an error line and a new worker is forked to carry on with its queue, so
+every ROM still ends up with exactly one line.
+
+Manifest lines are "<Rom> [Cycles] [InputLog or -] [Seed]" with # comments. A directory runs every file in it with the
+default cycle budget and no input.
+*/
+
+#define CORPUS_PATH_SIZE 512
+
+typedef struct CorpusJob {
+    char rom[CORPUS_PATH_SIZE];
+    char inputLog[CORPUS_PATH_SIZE];
+    uint64_t cycles;
+    uint32_t seed;
+} CorpusJob;
+
+//The jobs still queued for one worker are top up to (not including) bottom. Owner takes bottom - 1, thieves take top
+typedef struct WorkQueue {
+    pthread_mutex_t lock;
+    int top;
+    int bottom;
+    //Job the owner is in the middle of, -1 between jobs. If the worker dies this is the one that killed it
+    int running;
+} WorkQueue;
+
+typedef struct WorkerStats {
+    uint64_t jobs;
+    uint64_t executed;
+    uint64_t steals;
+    uint64_t errors;
+    uint64_t busyNanos;
+    uint64_t reasons[EXIT_FAULT + 1];
+} WorkerStats;
+
+typedef struct CorpusShared {
+    int workers;
+    WorkQueue* queues;
+    WorkerStats* stats;
+} CorpusShared;
+
+int compareNames(void const* a, void const* b) {
+    return strcmp(((CorpusJob const*)a)->rom, ((CorpusJob const*)b)->rom);
+}
+
+//Returns how many jobs went into jobs, growing it as needed. -1 if the path can't be read
+int loadCorpus(char const* path, uint64_t defaultCycles, CorpusJob** jobs) {
+    int capacity = 256;
+    int count = 0;
+    struct stat info;
+
+    *jobs = (CorpusJob*)malloc(capacity * sizeof(CorpusJob));
+
+    if (stat(path, &info) < 0) {
+        return -1;
+    }
+
+    if (S_ISDIR(info.st_mode)) {
+        DIR* directory = opendir(path);
+        struct dirent* entry;
+
+        if (directory == NULL) {
+            return -1;
+        }
+
+        while ((entry = readdir(directory)) != NULL) {
+            char rom[CORPUS_PATH_SIZE];
+            struct stat romInfo;
+
+            if (snprintf(rom, sizeof(rom), "%s/%s", path, entry->d_name) >= (int)sizeof(rom) || stat(rom, &romInfo) < 0 || !S_ISREG(romInfo.st_mode)) {
+                continue;
+            }
+
+            if (count == capacity) {
+                capacity *= 2;
+                *jobs = (CorpusJob*)realloc(*jobs, capacity * sizeof(CorpusJob));
+            }
+
+            strcpy((*jobs)[count].rom, rom);
+            strcpy((*jobs)[count].inputLog, "-");
+            (*jobs)[count].cycles = defaultCycles;
+            (*jobs)[count].seed = 0;
+            ++count;
+        }
+
+        closedir(directory);
+
+        //readdir order is whatever the filesystem feels like
+        qsort(*jobs, count, sizeof(CorpusJob), compareNames);
+
+        return count;
+    }
+
+    FILE* manifest = fopen(path, "r");
+    char line[CORPUS_PATH_SIZE * 2 + 64];
+
+    if (manifest == NULL) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), manifest) != NULL) {
+        CorpusJob job;
+        unsigned long long cycles = defaultCycles;
+
+        strcpy(job.inputLog, "-");
+        job.seed = 0;
+
+        if (line[0] == '#' || sscanf(line, "%511s %llu %511s %u", job.rom, &cycles, job.inputLog, &job.seed) < 1) {
+            continue;
+        }
+
+        job.cycles = cycles;
+
+        if (count == capacity) {
+            capacity *= 2;
+            *jobs = (CorpusJob*)realloc(*jobs, capacity * sizeof(CorpusJob));
+        }
+
+        (*jobs)[count++] = job;
+    }
+
+    fclose(manifest);
+
+    return count;
+}
+
+//The locks are robust so a worker that dies holding one doesn't hang everyone else. The queue is just two ints that
+//are never half updated so whatever the dead worker left is fine to carry on with
+void lockQueue(WorkQueue* queue) {
+    if (pthread_mutex_lock(&queue->lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&queue->lock);
+    }
+}
+
+int takeJob(CorpusShared* shared, int worker) {
+    WorkQueue* queue = &shared->queues[worker];
+    int job = -1;
+
+    lockQueue(queue);
+
+    if (queue->bottom > queue->top) {
+        job = --queue->bottom;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return job;
+}
+
+//Nothing new ever gets queued so one pass over everyone finding nothing means the corpus is done
+int stealJob(CorpusShared* shared, int worker) {
+    for (int i = 1; i < shared->workers; ++i) {
+        WorkQueue* queue = &shared->queues[(worker + i) % shared->workers];
+        int job = -1;
+
+        lockQueue(queue);
+
+        if (queue->bottom > queue->top) {
+            job = queue->top++;
+        }
+
+        pthread_mutex_unlock(&queue->lock);
+
+        if (job >= 0) {
+            ++shared->stats[worker].steals;
+            return job;
+        }
+    }
+
+    return -1;
+}
+
+//Just enough JSON string escaping for file paths
+void writeJsonString(char* out, size_t size, char const* text) {
+    size_t length = 0;
+
+    for (char const* c = text; *c != '\0' && length + 7 < size; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out[length++] = '\\';
+            out[length++] = *c;
+        } else if ((unsigned char)*c < 0x20) {
+            length += sprintf(out + length, "\\u%04x", (unsigned char)*c);
+        } else {
+            out[length++] = *c;
+        }
+    }
+
+    out[length] = '\0';
+}
+
+int formatCorpusError(char* line, size_t size, CorpusJob const* job, char const* error, int worker) {
+    char rom[CORPUS_PATH_SIZE * 2];
+
+    writeJsonString(rom, sizeof(rom), job->rom);
+
+    return snprintf(line, size, "{\"rom\":\"%s\",\"error\":\"%s\",\"worker\":%d}\n", rom, error, worker);
+}
+
+void runCorpusJob(CorpusJob const* job, int worker, int report, WorkerStats* stats, InputEvent* events) {
+    char line[CORPUS_PATH_SIZE * 2 + 512];
+    int length;
+    uint64_t start = nanoTime();
+
+    initMachine();
+    seedRandom(job->seed);
+
+    int eventCount = 0;
+
+    if (strcmp(job->inputLog, "-") != 0) {
+        eventCount = loadInputLog(job->inputLog, events, MAX_INPUT_EVENTS);
+    }
+
+    if (!loadROM(job->rom) || eventCount < 0) {
+        length = formatCorpusError(line, sizeof(line), job, (eventCount < 0) ? "couldn't load input log" : "couldn't load ROM", worker);
+        ++stats->errors;
+    } else {
+        RunResult result = runHeadless(job->cycles, events, eventCount);
+        uint64_t wallNanos = nanoTime() - start;
+        char rom[CORPUS_PATH_SIZE * 2];
+
+        writeJsonString(rom, sizeof(rom), job->rom);
+
+        length = snprintf(line, sizeof(line),
+            "{\"rom\":\"%s\",\"cycles\":%llu,\"executed\":%llu,\"exit\":\"%s\",\"fault\":\"%s\",\"hash\":\"%016llX\",\"pc\":%u,\"wallUs\":%.1f,\"worker\":%d}\n",
+            rom, (unsigned long long)result.cycles, (unsigned long long)result.executed, exitReasonName(result.reason),
+            faultName(machineFault), (unsigned long long)hashDisplay(), pc, wallNanos / 1000.0, worker);
+
+        stats->executed += result.executed;
+        ++stats->reasons[result.reason];
+    }
+
+    //The report is opened with O_APPEND so a whole line in one write never gets mixed up with another worker's
+    if (write(report, line, length) != length) {
+        perror("write report");
+        ++stats->errors;
+    }
+
+    ++stats->jobs;
+    stats->busyNanos += nanoTime() - start;
+}
+
+void runCorpusWorker(CorpusShared* shared, CorpusJob const* jobs, int worker, int report) {
+    InputEvent* events = (InputEvent*)malloc(MAX_INPUT_EVENTS * sizeof(InputEvent));
+    int job;
+
+    while ((job = takeJob(shared, worker)) >= 0 || (job = stealJob(shared, worker)) >= 0) {
+        shared->queues[worker].running = job;
+        runCorpusJob(&jobs[job], worker, report, &shared->stats[worker], events);
+        shared->queues[worker].running = -1;
+    }
+
+    free(events);
+}
+
+void runCorpus(char const* corpusPath, char const* reportPath, int workers, uint64_t defaultCycles) {
+    traceOpcodes = false;
+    initTables();
+
+    CorpusJob* jobs;
+    int jobCount = loadCorpus(corpusPath, defaultCycles, &jobs);
+
+    if (jobCount < 0) {
+        printf("Couldn't read corpus %s\n", corpusPath);
+        exit(EXIT_FAILURE);
+    }
+
+    if (workers < 1) {
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    if (workers > jobCount) {
+        workers = (jobCount > 0) ? jobCount : 1;
+    }
+
+    int report = open(reportPath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+    if (report < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t sharedSize = workers * (sizeof(WorkQueue) + sizeof(WorkerStats));
+    uint8_t* mapped = (uint8_t*)mmap(NULL, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (mapped == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+
+    CorpusShared shared = { workers, (WorkQueue*)mapped, (WorkerStats*)(mapped + workers * sizeof(WorkQueue)) };
+    pthread_mutexattr_t lockAttributes;
+
+    pthread_mutexattr_init(&lockAttributes);
+    pthread_mutexattr_setpshared(&lockAttributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&lockAttributes, PTHREAD_MUTEX_ROBUST);
+
+    //Worker i starts with the i-th slice of the corpus
+    for (int i = 0; i < workers; ++i) {
+        pthread_mutex_init(&shared.queues[i].lock, &lockAttributes);
+        shared.queues[i].top = (int)((int64_t)jobCount * i / workers);
+        shared.queues[i].bottom = (int)((int64_t)jobCount * (i + 1) / workers);
+        shared.queues[i].running = -1;
+    }
+
+    uint64_t start = nanoTime();
+    pid_t* children = (pid_t*)malloc(workers * sizeof(pid_t));
+
+    for (int i = 0; i < workers; ++i) {
+        children[i] = fork();
+
+        if (children[i] == 0) {
+            runCorpusWorker(&shared, jobs, i, report);
+            _exit(0);
+        }
+    }
+
+    int alive = workers;
+    uint64_t lost = 0;
+
+    while (alive > 0) {
+        int status;
+        pid_t child = wait(&status);
+
+        if (child < 0) {
+            break;
+        }
+
+        int worker = 0;
+
+        while (worker < workers && children[worker] != child) {
+            ++worker;
+        }
+
+        if (worker == workers) {
+            continue;
+        }
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            --alive;
+            continue;
+        }
+
+        //The ROM it was running gets an error line instead of a result and isn't tried again
+        int job = shared.queues[worker].running;
+
+        if (job >= 0) {
+            char line[CORPUS_PATH_SIZE * 2 + 64];
+            char error[64];
+
+            if (WIFSIGNALED(status)) {
+                snprintf(error, sizeof(error), "worker killed by signal %d", WTERMSIG(status));
+            } else {
+                snprintf(error, sizeof(error), "worker exited with status %d", WEXITSTATUS(status));
+            }
+
+            int length = formatCorpusError(line, sizeof(line), &jobs[job], error, worker);
+
+            if (write(report, line, length) != length) {
+                perror("write report");
+            }
+
+            shared.queues[worker].running = -1;
+            ++lost;
+        }
+
+        //Whatever was still queued for it goes to a fresh worker on the same queue
+        children[worker] = fork();
+
+        if (children[worker] == 0) {
+            runCorpusWorker(&shared, jobs, worker, report);
+            _exit(0);
+        }
+
+        if (children[worker] < 0) {
+            perror("fork");
+            --alive;
+        }
+    }
+
+    //Only left over if a replacement couldn't be forked and nobody else stole them
+    for (int i = 0; i < workers; ++i) {
+        for (int job = shared.queues[i].top; job < shared.queues[i].bottom; ++job) {
+            char line[CORPUS_PATH_SIZE * 2 + 64];
+            int length = formatCorpusError(line, sizeof(line), &jobs[job], "never ran", i);
+
+            if (write(report, line, length) != length) {
+                perror("write report");
+            }
+
+            ++lost;
+        }
+    }
+
+    double seconds = (nanoTime() - start) / 1e9;
+    WorkerStats total;
+    memset(&total, 0, sizeof(total));
+
+    for (int i = 0; i < workers; ++i) {
+        WorkerStats const* stats = &shared.stats[i];
+
+        total.jobs += stats->jobs;
+        total.executed += stats->executed;
+        total.steals += stats->steals;
+        total.errors += stats->errors;
+        total.busyNanos += stats->busyNanos;
+
+        for (int reason = 0; reason <= EXIT_FAULT; ++reason) {
+            total.reasons[reason] += stats->reasons[reason];
+        }
+    }
+
+    printf("%llu ROMs on %d workers in %.2fs (%.1f ROMs/s, %.1fM instructions/s, %.0f%% busy), %llu steals\n",
+        (unsigned long long)total.jobs, workers, seconds, total.jobs / seconds, total.executed / seconds / 1e6,
+        100.0 * total.busyNanos / 1e9 / (seconds * workers), (unsigned long long)total.steals);
+    printf("exit:");
+
+    for (int reason = 0; reason <= EXIT_FAULT; ++reason) {
+        printf(" %s %llu", exitReasonName(reason), (unsigned long long)total.reasons[reason]);
+    }
+
+    printf(", errors %llu, lost to dead workers %llu\n", (unsigned long long)total.errors, (unsigned long long)lost);
+
+    close(report);
+    munmap(mapped, sharedSize);
+    free(children);
+    free(jobs);
+}
+
+//GDB remote stub
+
+/*
+Speaks the GDB remote serial protocol over TCP (port number) or a unix socket (path) so a debugger can poke at the
+machine while the normal window keeps running. Register numbers for g/G/p/P:
+    0-15  V0-VF (1 byte)
+    16    I (2 bytes)
+    17    PC (2 bytes)
+    18    SP (1 byte)
+    19    DT (1 byte)
+    20    ST (1 byte)
+    21-36 stack[0]-stack[15] (2 bytes)
+Everything is little endian like gdb expects.
+
+Breakpoints and watchpoints are one bit per address over the whole 4KB so checking one is a single lookup. None of it
+gets looked at unless debuggerAttached is set, so without a debugger fdeLoop only pays for one branch.
+*/
+
+#define DEBUG_REGISTER_COUNT 37
+#define DEBUG_PACKET_SIZE 4096
+#define SIGNAL_TRAP 5
+#define SIGNAL_INTERRUPT 2
+
+uint8_t breakpointMap[4096 / 8];
+uint8_t readWatchMap[4096 / 8];
+uint8_t writeWatchMap[4096 / 8];
+uint8_t accessWatchMap[4096 / 8];
+
+typedef struct Debugger {
+    int socket;
+    bool stopped;
+    bool stepping;
+    //Resuming from a breakpoint has to run the instruction under it once instead of stopping again straight away
+    int skipBreakpointAt;
+    //Set by a watched access during an instruction, reported once the instruction finishes as watch, rwatch or awatch
+    int watchAddress;
+    char const* watchKind;
+    //PacketSize we advertise plus the $, #xx and a terminator
+    char input[DEBUG_PACKET_SIZE + 8];
+    int inputLength;
+} Debugger;
+
+Debugger debugger;
+
+static inline bool testBit(uint8_t const* map, uint16_t address) {
+    return map[(address & 0xFFFu) >> 3] & (1u << (address & 7u));
+}
+
+void setBits(uint8_t* map, uint32_t address, uint32_t length, bool on) {
+    for (uint32_t i = 0; i < length && address + i < 4096; ++i) {
+        if (on) {
+            map[(address + i) >> 3] |= 1u << ((address + i) & 7u);
+        } else {
+            map[(address + i) >> 3] &= ~(1u << ((address + i) & 7u));
+        }
+    }
+}
+
+//Checksum is the sum of the payload bytes mod 256
+void debugSend(char const* payload) {
+    char packet[DEBUG_PACKET_SIZE * 2 + 8];
+    uint8_t checksum = 0;
+
+    for (char const* c = payload; *c != '\0'; ++c) {
+        checksum += (uint8_t)*c;
+    }
+
+    int length = snprintf(packet, sizeof(packet), "$%s#%02x", payload, checksum);
+    send(debugger.socket, packet, length, MSG_NOSIGNAL);
+}
+
+void debugSendStop(int signal) {
+    char reply[64];
+
+    if (debugger.watchAddress >= 0) {
+        sprintf(reply, "T%02x%s:%x;", signal, debugger.watchKind, debugger.watchAddress);
+    } else {
+        sprintf(reply, "S%02x", signal);
+    }
+
+    debugSend(reply);
+}
+
+void debugStop(int signal) {
+    debugger.stopped = true;
+    debugger.stepping = false;
+    debugSendStop(signal);
+    debugger.watchAddress = -1;
+}
+
+//Called from the opcodes that touch memory through idx
+void debugCheckWatch(uint16_t address, int length, bool write) {
+    uint8_t const* map = write ? writeWatchMap : readWatchMap;
+
+    for (int i = 0; i < length; ++i) {
+        if (testBit(map, address + i)) {
+            debugger.watchKind = write ? "watch" : "rwatch";
+        } else if (testBit(accessWatchMap, address + i)) {
+            debugger.watchKind = "awatch";
+        } else {
+            continue;
+        }
+
+        debugger.watchAddress = (address + i) & 0xFFFu;
+        return;
+    }
+}
+
+//False means the instruction at pc shouldn't run
+bool debugBeforeInstruction() {
+    if (debugger.stopped) {
+        return false;
+    }
+
+    if (testBit(breakpointMap, pc) && debugger.skipBreakpointAt != pc) {
+        debugStop(SIGNAL_TRAP);
+        return false;
+    }
+
+    debugger.skipBreakpointAt = -1;
+
+    return true;
+}
+
+void debugAfterInstruction() {
+    if (debugger.watchAddress >= 0 || debugger.stepping) {
+        debugStop(SIGNAL_TRAP);
+    }
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+//Reads hex digits and moves the cursor past them
+uint32_t parseHex(char const** cursor) {
+    uint32_t value = 0;
+
+    while (hexValue(**cursor) >= 0) {
+        value = (value << 4) | hexValue(**cursor);
+        ++*cursor;
+    }
+
+    return value;
+}
+
+//Size in bytes and where the register lives
+int debugRegister(int number, uint8_t** bytes) {
+    if (number < 16) {
+        *bytes = &registers[number];
+        return 1;
+    }
+
+    switch (number) {
+        case 16:
+            *bytes = (uint8_t*)&idx;
+            return 2;
+        case 17:
+            *bytes = (uint8_t*)&pc;
+            return 2;
+        case 18:
+            *bytes = &stackPointer;
+            return 1;
+        case 19:
+            *bytes = &delayTimer;
+            return 1;
+        case 20:
+            *bytes = &soundTimer;
+            return 1;
+        default:
+            break;
+    }
+
+    if (number < DEBUG_REGISTER_COUNT) {
+        *bytes = (uint8_t*)&stack[number - 21];
+        return 2;
+    }
+
+    return 0;
+}
+
+//The 16 bit registers are stored little endian on the host and gdb wants little endian so the bytes go out as they are
+char* debugWriteRegister(char* out, int number) {
+    uint8_t* bytes;
+    int size = debugRegister(number, &bytes);
+
+    for (int i = 0; i < size; ++i) {
+        out += sprintf(out, "%02x", bytes[i]);
+    }
+
+    return out;
+}
+
+char const* debugReadRegister(char const* in, int number) {
+    uint8_t* bytes;
+    int size = debugRegister(number, &bytes);
+
+    for (int i = 0; i < size && hexValue(in[0]) >= 0 && hexValue(in[1]) >= 0; ++i) {
+        bytes[i] = (hexValue(in[0]) << 4) | hexValue(in[1]);
+        in += 2;
+    }
+
+    //00EE trusts that sp never goes past the end of the stack
+    if (stackPointer > 16) {
+        stackPointer = 16;
+    }
+
+    return in;
+}
+
+void debugResume(char const* args, bool step) {
+    if (*args != '\0') {
+        pc = parseHex(&args) & 0xFFFu;
+    }
+
+    debugger.skipBreakpointAt = pc;
+    debugger.stepping = step;
+    debugger.stopped = false;
+}
+
+void debugDetach() {
+    memset(breakpointMap, 0, sizeof(breakpointMap));
+    memset(readWatchMap, 0, sizeof(readWatchMap));
+    memset(writeWatchMap, 0, sizeof(writeWatchMap));
+    memset(accessWatchMap, 0, sizeof(accessWatchMap));
+    close(debugger.socket);
+    debuggerAttached = false;
+    printf("Debugger detached\n");
+}
+
+//Z/z type 0 and 1 are breakpoints, 2 is a write watchpoint, 3 read, 4 both
+void debugBreakpoint(char const* args, bool on) {
+    int type = args[0] - '0';
+    args += 2;
+    uint32_t address = parseHex(&args);
+    uint32_t length = 1;
+
+    if (*args == ',') {
+        ++args;
+        length = parseHex(&args);
+    }
+
+    switch (type) {
+        case 0:
+        case 1:
+            setBits(breakpointMap, address, 1, on);
+            break;
+        case 2:
+            setBits(writeWatchMap, address, length, on);
+            break;
+        case 3:
+            setBits(readWatchMap, address, length, on);
+            break;
+        case 4:
+            setBits(accessWatchMap, address, length, on);
+            break;
+        default:
+            debugSend("");
+            return;
+    }
+
+    debugSend("OK");
+}
+
+void debugHandlePacket(char* packet) {
+    static char reply[DEBUG_PACKET_SIZE * 2 + 1];
+    char const* args = packet + 1;
+
+    switch (packet[0]) {
+        case '?':
+            debugSendStop(SIGNAL_TRAP);
+            return;
+        case 'g': {
+            char* out = reply;
+
+            for (int i = 0; i < DEBUG_REGISTER_COUNT; ++i) {
+                out = debugWriteRegister(out, i);
+            }
+
+            debugSend(reply);
+            return;
+        }
+        case 'G':
+            for (int i = 0; i < DEBUG_REGISTER_COUNT; ++i) {
+                args = debugReadRegister(args, i);
+            }
+
+            debugSend("OK");
+            return;
+        case 'p': {
+            int number = parseHex(&args);
+
+            if (number >= DEBUG_REGISTER_COUNT) {
+                debugSend("E01");
+                return;
+            }
+
+            *debugWriteRegister(reply, number) = '\0';
+            debugSend(reply);
+            return;
+        }
+        case 'P': {
+            int number = parseHex(&args);
+
+            if (number >= DEBUG_REGISTER_COUNT || *args != '=') {
+                debugSend("E01");
+                return;
+            }
+
+            debugReadRegister(args + 1, number);
+            debugSend("OK");
+            return;
+        }
+        case 'm': {
+            uint32_t address = parseHex(&args);
+            ++args;
+            uint32_t length = parseHex(&args);
+            char* out = reply;
+
+            if (address >= MEMORY_SIZE) {
+                debugSend("E01");
+                return;
+            }
+
+            for (uint32_t i = 0; i < length && address + i < MEMORY_SIZE && i < DEBUG_PACKET_SIZE / 2; ++i) {
+                out += sprintf(out, "%02x", readMemory(address + i));
+            }
+
+            *out = '\0';
+            debugSend(reply);
+            return;
+        }
+        case 'M': {
+            uint32_t address = parseHex(&args);
+            ++args;
+            uint32_t length = parseHex(&args);
+            ++args;
+
+            if (address + length > MEMORY_SIZE) {
+                debugSend("E01");
+                return;
+            }
+
+            for (uint32_t i = 0; i < length && hexValue(args[0]) >= 0 && hexValue(args[1]) >= 0; ++i) {
+                writeMemory(address + i, (hexValue(args[0]) << 4) | hexValue(args[1]));
+                args += 2;
+            }
+
+            debugSend("OK");
+            return;
+        }
+        case 'c':
+            debugResume(args, false);
+            return;
+        case 's':
+            debugResume(args, true);
+            return;
+        case 'Z':
+            debugBreakpoint(args, true);
+            return;
+        case 'z':
+            debugBreakpoint(args, false);
+            return;
+        case 'H':
+        case 'T':
+            debugSend("OK");
+            return;
+        case 'D':
+            debugSend("OK");
+            debugDetach();
+            return;
+        case 'k':
+            debugDetach();
+            exit(0);
+        case 'q':
+            if (strncmp(packet, "qSupported", 10) == 0) {
+                debugSend("PacketSize=1000");
+            } else if (strcmp(packet, "qAttached") == 0) {
+                debugSend("1");
+            } else if (strcmp(packet, "qC") == 0) {
+                debugSend("QC1");
+            } else if (strcmp(packet, "qfThreadInfo") == 0) {
+                debugSend("m1");
+            } else if (strcmp(packet, "qsThreadInfo") == 0) {
+                debugSend("l");
+            } else {
+                debugSend("");
+            }
+            return;
+        default:
+            //Empty reply means not supported, gdb falls back to something it can use
+            debugSend("");
+            return;
+    }
+}
+
+//Reads whatever gdb sent without blocking and handles every whole packet in it
+void pollDebugger() {
+    //Full and still no whole packet means it's garbage or bigger than we said we take. Drop it and NAK rather than
+    //calling recv with no room, which returns 0 and looks like gdb went away
+    if (debugger.inputLength >= (int)sizeof(debugger.input) - 1) {
+        debugger.inputLength = 0;
+        send(debugger.socket, "-", 1, MSG_NOSIGNAL);
+    }
+
+    int got = recv(debugger.socket, debugger.input + debugger.inputLength, sizeof(debugger.input) - 1 - debugger.inputLength, MSG_DONTWAIT);
+
+    if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        debugDetach();
+        return;
+    }
+
+    if (got > 0) {
+        debugger.inputLength += got;
+    }
+
+    debugger.input[debugger.inputLength] = '\0';
+
+    char* cursor = debugger.input;
+
+    while (*cursor != '\0') {
+        //Ctrl-C in gdb
+        if (*cursor == 0x03) {
+            ++cursor;
+
+            if (!debugger.stopped) {
+                debugStop(SIGNAL_INTERRUPT);
+            }
+
+            continue;
+        }
+
+        if (*cursor != '$') {
+            ++cursor;
+            continue;
+        }
+
+        char* end = strchr(cursor, '#');
+
+        //Rest of the packet hasn't arrived yet
+        if (end == NULL || end[1] == '\0' || end[2] == '\0') {
+            break;
+        }
+
+        *end = '\0';
+        send(debugger.socket, "+", 1, MSG_NOSIGNAL);
+        debugHandlePacket(cursor + 1);
+        cursor = end + 3;
+
+        if (!debuggerAttached) {
+            return;
+        }
+    }
+
+    debugger.inputLength = strlen(cursor);
+    memmove(debugger.input, cursor, debugger.inputLength + 1);
+}
+
+//Waits for gdb to connect. The machine starts stopped at the first instruction
+void startDebugger(char const* address) {
+    bool isPort = address[0] != '\0' && strspn(address, "0123456789") == strlen(address);
+    int server;
+
+    if (isPort) {
+        server = socket(AF_INET, SOCK_STREAM, 0);
+
+        int reuse = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        struct sockaddr_in tcpAddress;
+        memset(&tcpAddress, 0, sizeof(tcpAddress));
+        tcpAddress.sin_family = AF_INET;
+        tcpAddress.sin_port = htons(atoi(address));
+        tcpAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(server, (struct sockaddr*)&tcpAddress, sizeof(tcpAddress)) < 0) {
+            perror("bind");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        server = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        struct sockaddr_un unixAddress;
+        memset(&unixAddress, 0, sizeof(unixAddress));
+        unixAddress.sun_family = AF_UNIX;
+        strncpy(unixAddress.sun_path, address, sizeof(unixAddress.sun_path) - 1);
+        unlink(address);
+
+        if (bind(server, (struct sockaddr*)&unixAddress, sizeof(unixAddress)) < 0) {
+            perror("bind");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    listen(server, 1);
+    printf("Waiting for gdb on %s\n", address);
+    fflush(stdout);
+
+    debugger.socket = accept(server, NULL, NULL);
+    close(server);
+
+    if (debugger.socket < 0) {
+        perror("accept");
+        exit(EXIT_FAILURE);
+    }
+
+    debugger.stopped = true;
+    debugger.stepping = false;
+    debugger.skipBreakpointAt = -1;
+    debugger.watchAddress = -1;
+    debugger.inputLength = 0;
+    debuggerAttached = true;
+    printf("Debugger attached\n");
+}
+
+//Shared memory export (the layout and the reader side live in chip8_shm.h)
+
+bool createSharedState(char const* name) {
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    if (ftruncate(fd, sizeof(Chip8Shared)) < 0) {
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(NULL, sizeof(Chip8Shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    sharedState = (Chip8Shared*)mapped;
+    memset(sharedState, 0, sizeof(Chip8Shared));
+    sharedState->magic = CHIP8_SHM_MAGIC;
+    sharedState->version = CHIP8_SHM_VERSION;
+
+    return true;
+}
+
+//Seqlock write. Odd sequence means a publish is in progress so readers retry, even means the state is whole again
+void publishState() {
+    if (sharedState == NULL) {
+        return;
+    }
+
+    uint32_t sequence = atomic_load_explicit(&sharedState->sequence, memory_order_relaxed);
+    atomic_store_explicit(&sharedState->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    Chip8State* state = &sharedState->state;
+
+    memcpy(state->registers, registers, sizeof(registers));
+    state->pc = pc;
+    state->idx = idx;
+    state->delayTimer = delayTimer;
+    state->soundTimer = soundTimer;
+    ++state->frame;
+
+    //The screen is most of the segment so only copy it when something actually drew
+    if (displayDirty) {
+        memcpy(state->display, display, sizeof(display));
+        displayDirty = false;
+    }
+
+    atomic_store_explicit(&sharedState->sequence, sequence + 2, memory_order_release);
+}
+
+void initSDL(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight) {
+    if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
+        printf("Couldn't init SDL SDL_ERROR: %s", SDL_GetError());
+        return;
+    }
+
+    sdlVars.window = SDL_CreateWindow(title, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
+
+    if (sdlVars.window == NULL) {
+        printf("Couldn't create window SDL_ERROR: %s", SDL_GetError());
+        return;
+    }
+
+    sdlVars.renderer = SDL_CreateRenderer(sdlVars.window, -1, SDL_RENDERER_ACCELERATED);
+
+    sdlVars.texture = SDL_CreateTexture(sdlVars.renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
+}
+
+bool proccessInput(uint8_t* keypad) {
+    SDL_Event event;
+    bool shouldStop = false;
+
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+            case SDL_QUIT:
+                shouldStop = true;
+                break;
+            case SDL_KEYDOWN:
+                switch (event.key.keysym.sym) {
+                    case SDLK_1:
+                        keypad[1] = 1;
+                        break;
+                    case SDLK_2:
+                        keypad[2] = 1;
+                        break;
+                    case SDLK_3:
+                        keypad[3] = 1;   
+                        break;
+                    case SDLK_4:
+                        keypad[0xC] = 1;
+                        break;
+                    case SDLK_q:
+                        keypad[4] = 1;
+                        break;
+                    case SDLK_w:
+                        keypad[5] = 1;
+                        break;
+                    case SDLK_e:
+                        keypad[6] = 1;
+                        break;
+                    case SDLK_r:
+                        keypad[0xD] = 1;
+                        break;
+                    case SDLK_a:
+                        keypad[7] = 1;
+                        break;
+                    case SDLK_s:
+                        keypad[8] = 1;
+                        break;
+                    case SDLK_d:
+                        keypad[9] = 1;
+                        break;
+                    case SDLK_f:
+                        keypad[0xE] = 1;
+                        break;
+                    case SDLK_z:
+                        keypad[0xA] = 1;
+                        break;
+                    case SDLK_x:
+                        keypad[0] = 1;
+                        break;
+                    case SDLK_c:
+                        keypad[0xB] = 1;
+                        break;
+                    case SDLK_v:
+                        keypad[0xF] = 1;  
+                        break;                                
+                    case SDLK_ESCAPE:
+                        shouldStop = true;
+                        break;
+                    default:
+                        break;    
+            }
+            break;
+
+            case SDL_KEYUP:
+                switch (event.key.keysym.sym) {
+                    case SDLK_1:
+                        keypad[1] = 0;
+                        break;
+                    case SDLK_2:
+                        keypad[2] = 0;
+                        break;
+                    case SDLK_3:
+                        keypad[3] = 0;   
+                        break;
+                    case SDLK_4:
+                        keypad[0xC] = 0;
+                        break;
+                    case SDLK_q:
+                        keypad[4] = 0;
+                        break;
+                    case SDLK_w:
+                        keypad[5] = 0;
+                        break;
+                    case SDLK_e:
+                        keypad[6] = 0;
+                        break;
+                    case SDLK_r:
+                        keypad[0xD] = 0;
+                        break;
+                    case SDLK_a:
+                        keypad[7] = 0;
+                        break;
+                    case SDLK_s:
+                        keypad[8] = 0;
+                        break;
+                    case SDLK_d:
+                        keypad[9] = 0;
+                        break;
+                    case SDLK_f:
+                        keypad[0xE] = 0;
+                        break;
+                    case SDLK_z:
+                        keypad[0xA] = 0;
+                        break;
+                    case SDLK_x:
+                        keypad[0] = 0;
+                        break;
+                    case SDLK_c:
+                        keypad[0xB] = 0;
+                        break;
+                    case SDLK_v:
+                        keypad[0xF] = 0;
+                        break;
+                    default:
+                        break;    
+                }
+                break;
+        }
+    }
+
+    return shouldStop;
+}
+
+//The texture wants a uint32_t per pixel so the packed rows get spread out first
 void updateDisplay(void const* buffer, int pitch) {
-    SDL_UpdateTexture(sdlVars.texture, NULL, display, pitch);
+    static uint32_t pixels[64 * 32];
+
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        for (int x = 0; x < SCREEN_WIDTH; ++x) {
+            pixels[y * SCREEN_WIDTH + x] = ((display[y] >> (63 - x)) & 1u) ? 0xFFFFFFFF : 0;
+        }
+    }
+
+    SDL_UpdateTexture(sdlVars.texture, NULL, pixels, pitch);
     SDL_RenderClear(sdlVars.renderer);
     SDL_RenderCopy(sdlVars.renderer, sdlVars.texture, NULL, NULL);
     SDL_RenderPresent(sdlVars.renderer);
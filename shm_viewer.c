@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "chip8_shm.h"
+
+//Sample reader for the shared memory export. Prints the screen and registers in the terminal whenever a new frame shows up
+//Start the emulator with a shm name first, e.g. ./chip8 10 3 pong.ch8 /chip8 and then ./shm_viewer /chip8
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        printf("Usage %s <ShmName>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    Chip8Shared const* shared = openSharedState(argv[1]);
+
+    if (shared == NULL) {
+        printf("Couldn't open %s (is the emulator running?)\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    Chip8State state;
+    uint32_t lastSequence = 0;
+    struct timespec pause = { 0, 33 * 1000 * 1000 };
+
+    while (true) {
+        //Nothing new so dont bother copying
+        if (sharedStateSequence(shared) == lastSequence) {
+            nanosleep(&pause, NULL);
+            continue;
+        }
+
+        readSharedState(shared, &state);
+        lastSequence = sharedStateSequence(shared);
+
+        //Move the cursor back to the top left so it redraws in place
+        printf("\033[H");
+
+        for (int y = 0; y < 32; ++y) {
+            char line[64 + 1];
+
+            for (int x = 0; x < 64; ++x) {
+                line[x] = sharedPixel(&state, x, y) ? '#' : ' ';
+            }
+
+            line[64] = '\0';
+            printf("|%s|\n", line);
+        }
+
+        printf("frame %llu pc 0x%03X idx 0x%03X dt %3u st %3u\n", (unsigned long long)state.frame, state.pc, state.idx, state.delayTimer, state.soundTimer);
+
+        for (int i = 0; i < 16; ++i) {
+            printf("V%X=%02X ", i, state.registers[i]);
+        }
+
+        printf("\n");
+        fflush(stdout);
+
+        nanosleep(&pause, NULL);
+    }
+
+    return 0;
+}